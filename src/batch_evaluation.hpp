@@ -0,0 +1,153 @@
+#ifndef BATCH_EVALUATION_H
+#define BATCH_EVALUATION_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <typeinfo>
+#include <unordered_map>
+#include "myeig.hpp"
+#include "node.hpp"
+#include "operator.hpp"
+#include "util.hpp"
+#include "memory.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Common-subexpression sharing across trees.
+  In a converging population, many trees contain identical subtrees. The active part of
+  each tree in a batch is hash-consed into a DAG, so that each distinct subtree is computed
+  only once per batch. Outputs of DAG nodes are reference-counted and released as soon as
+  their last consumer has been computed, which keeps memory bounded by the "frontier" of
+  the DAG rather than by the number of trees.
+*/
+
+struct SubtreeDAG {
+
+  struct DAGNode {
+    Op * op;
+    vector<int> children;
+    int refs = 0;
+    bool is_const = false; // feature-free nodes are computed as scalars
+    float c = NAN;
+  };
+
+  vector<DAGNode> dag_nodes;
+  unordered_map<string, int> ids;
+  vector<vector<int>> roots_of; // for each DAG node, the trees whose root it is
+
+  int add(Node * n) {
+    Op * op = n->op;
+    int a = op->arity();
+    vector<int> children; children.reserve(a);
+    for(int i = 0; i < a; i++)
+      children.push_back(add(n->children[i]));
+
+    // key: operator type, payload (feature index or constant bits), children ids
+    size_t type_hash = typeid(*op).hash_code();
+    int payload = 0;
+    if (op->type() == OpType::otFeat) {
+      payload = ((Feat*)op)->id;
+    } else if (op->type() == OpType::otConst) {
+      if (isnan(((Const*)op)->c))
+        ((Const*)op)->_sample();
+      memcpy(&payload, &((Const*)op)->c, sizeof(float));
+    }
+    string key((char*) &type_hash, sizeof(size_t));
+    key.append((char*) &payload, sizeof(int));
+    if (a > 0)
+      key.append((char*) children.data(), a * sizeof(int));
+
+    auto it = ids.find(key);
+    if (it != ids.end())
+      return it->second;
+
+    int id = dag_nodes.size();
+    for(int c : children)
+      dag_nodes[c].refs++;
+    DAGNode dn;
+    dn.op = op;
+    dn.children = children;
+    dag_nodes.push_back(dn);
+    roots_of.push_back(vector<int>());
+    ids[key] = id;
+    return id;
+  }
+
+  void add_tree(Node * tree, int tree_idx) {
+    int id = add(tree);
+    dag_nodes[id].refs++;
+    roots_of[id].push_back(tree_idx);
+  }
+
+  // Computes the DAG, calling `consume(tree_idx, output)` as soon as the output of a tree is available
+  template<typename F>
+  void evaluate(Mat & X, F consume) {
+    int n = X.rows();
+    vector<Vec> outs(dag_nodes.size());
+    long long cache_bytes = 0; // of the outputs alive at any time
+    auto release = [&](int id) {
+      mem::add(mem::msCaches, -mem::bytes_of(outs[id]));
+      cache_bytes -= mem::bytes_of(outs[id]);
+      outs[id].resize(0);
+    };
+    // nodes were inserted in post-order, so children always come before their parents
+    for(int id = 0; id < dag_nodes.size(); id++) {
+      DAGNode & dn = dag_nodes[id];
+      int a = dn.children.size();
+      if (a == 0) {
+        if (dn.op->type() == OpType::otConst) {
+          dn.is_const = true;
+          dn.c = ((Const*)dn.op)->c;
+        } else {
+          outs[id] = dn.op->apply(X);
+        }
+      } else {
+        bool all_const = true;
+        for(int c : dn.children)
+          all_const = all_const && dag_nodes[c].is_const;
+
+        if (all_const) {
+          Mat c_row(1, a);
+          for(int i = 0; i < a; i++)
+            c_row(0, i) = dag_nodes[dn.children[i]].c;
+          dn.is_const = true;
+          dn.c = ((dn.op->apply(c_row) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION))[0];
+        } else {
+          Mat C(n, a);
+          for(int i = 0; i < a; i++) {
+            DAGNode & child = dag_nodes[dn.children[i]];
+            if (child.is_const)
+              C.col(i).setConstant(child.c);
+            else
+              C.col(i) = outs[dn.children[i]];
+          }
+          outs[id] = (dn.op->apply(C) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION);
+        }
+
+        // release children outputs that are no longer needed
+        for(int c : dn.children) {
+          if (--dag_nodes[c].refs == 0)
+            release(c);
+        }
+      }
+
+      if (!roots_of[id].empty() && dn.is_const)
+        outs[id] = Vec::Constant(n, dn.c);
+      mem::add(mem::msCaches, mem::bytes_of(outs[id]));
+      cache_bytes += mem::bytes_of(outs[id]);
+      for(int tree_idx : roots_of[id]) {
+        consume(tree_idx, outs[id]);
+        dn.refs--;
+      }
+      if (dn.refs == 0)
+        release(id);
+    }
+    mem::add(mem::msCaches, -cache_bytes);
+  }
+
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include "globals.hpp"
+#include "myeig.hpp"
+#include "util.hpp"
+#include "node.hpp"
+#include "variation.hpp"
+#include "fos.hpp"
+#include "ims.hpp"
+#include "rng.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Microbenchmarks of the core kernels, on synthetic data generated deterministically.
+  Usage: gpg_bench [-bench_filter <substring>] [-bench_min_time <seconds>] [-bench_out <path>] [gpg options]
+  One record per kernel & setting is written to stdout as JSON lines, or to -bench_out
+  (CSV if it ends with .csv, else JSON lines). Any other option is passed to gpg
+  (e.g., -fset, -ss_batch).
+*/
+
+namespace bench {
+
+  string filter = "";
+  double min_time = 0.2;
+  string out_path = "";
+  ostream * out = &cout;
+  bool csv = false;
+
+  const int SEED = 42;
+
+  void reseed() {
+    Rng::set_seed(SEED);
+    Rng::set_stream(0);
+  }
+
+  // Repeats f until min_time has elapsed (after a warm-up call), returns the seconds per call & the number of calls
+  template<typename F>
+  pair<double, int> time_per_call(F f) {
+    f();
+    int reps = 0;
+    auto start = prof::now();
+    double elapsed;
+    do {
+      f();
+      reps++;
+      elapsed = prof::elapsed(start);
+    } while (elapsed < min_time);
+    return make_pair(elapsed / reps, reps);
+  }
+
+  // items: how many units of work (e.g., node evaluations) a call performs
+  template<typename F>
+  void run(string name, string params, double items, string item_unit, F f) {
+    if (!filter.empty() && (name + " " + params).find(filter) == string::npos)
+      return;
+    auto res = time_per_call(f);
+    double seconds = res.first;
+    if (csv) {
+      *out << name << "," << params << "," << res.second << "," << seconds << "," << 1.0 / seconds
+        << "," << items / seconds << "," << item_unit << "\n";
+    } else {
+      *out << "{\"kernel\": \"" << name << "\", \"params\": \"" << params << "\", \"reps\": " << res.second
+        << ", \"seconds_per_call\": " << seconds << ", \"calls_per_second\": " << 1.0 / seconds
+        << ", \"items_per_second\": " << items / seconds << ", \"item_unit\": \"" << item_unit << "\"}\n";
+    }
+    out->flush();
+  }
+
+  // y = x_0 * x_1 + sin(x_2) - x_3 / (1 + x_4^2) (needs at least 5 features)
+  pair<Mat, Vec> synthetic_data(int n, int d) {
+    reseed();
+    Mat X = Rng::randn_mat(n, d);
+    Vec y = X.col(0) * X.col(1) + X.col(2).sin() - X.col(3) / (1 + X.col(4).square());
+    return make_pair(X, y);
+  }
+
+  void set_data(Mat & X, Vec & y) {
+    g::fit_func->set_Xy(X, y);
+    g::batch_size = X.rows();
+    for(auto * t : g::terminals)
+      delete t;
+    g::terminals.clear();
+    g::set_terminals("auto");
+    g::set_terminal_probabilities("auto");
+  }
+
+  vector<Node*> random_population(int pop_size, int depth) {
+    reseed();
+    g::max_depth = depth;
+    vector<Node*> population; population.reserve(pop_size);
+    for(int i = 0; i < pop_size; i++)
+      population.push_back(generate_tree(depth, "hh"));
+    return population;
+  }
+
+  void clear(vector<Node*> & population) {
+    for(Node * n : population)
+      n->clear();
+    population.clear();
+  }
+
+  long long num_active_nodes(vector<Node*> & population) {
+    long long num_nodes = 0;
+    for(Node * n : population)
+      num_nodes += n->get_num_nodes(true);
+    return num_nodes;
+  }
+
+  string params(vector<pair<string, int>> kv) {
+    string s;
+    for(auto & p : kv)
+      s += (s.empty() ? "" : ";") + p.first + "=" + to_string(p.second);
+    return s;
+  }
+
+  void get_output() {
+    for(int rows : {100, 1000, 10000}) {
+      auto Xy = synthetic_data(rows, 10);
+      for(int depth : {3, 5}) {
+        auto population = random_population(64, depth);
+        long long num_nodes = num_active_nodes(population);
+        run("get_output", params({{"rows", rows}, {"depth", depth}, {"trees", 64}}), num_nodes * rows, "node_rows", [&]() {
+          for(Node * n : population)
+            n->get_output(Xy.first);
+        });
+        if (spec::selected) {
+          run("get_output_specialized", params({{"rows", rows}, {"depth", depth}, {"trees", 64}}), num_nodes * rows, "node_rows", [&]() {
+            for(Node * n : population)
+              spec::get_output(n, Xy.first);
+          });
+        }
+        clear(population);
+      }
+    }
+  }
+
+  void fitness() {
+    for(Fitness * proto : g::all_fitness_functions) {
+      Fitness * f = proto->clone();
+      for(int rows : {100, 1000, 10000}) {
+        auto Xy = synthetic_data(rows, 10);
+        f->set_Xy(Xy.first, Xy.second);
+        for(int depth : {3, 5}) {
+          auto population = random_population(64, depth);
+          long long num_nodes = num_active_nodes(population);
+          run("fitness_" + f->name(), params({{"rows", rows}, {"depth", depth}, {"trees", 64}}), num_nodes * rows, "node_rows", [&]() {
+            for(Node * n : population)
+              f->get_fitness(n);
+          });
+          // population-level path (shared subtrees, as configured)
+          f->subtree_sharing_batch = g::fit_func->subtree_sharing_batch;
+          run("fitnesses_" + f->name(), params({{"rows", rows}, {"depth", depth}, {"trees", 64}}), num_nodes * rows, "node_rows", [&]() {
+            f->get_fitnesses(population);
+          });
+          clear(population);
+        }
+      }
+      delete f;
+    }
+  }
+
+  void linkage() {
+    FOSBuilder fb;
+    for(int pop_size : {256, 1024, 4096}) {
+      for(int depth : {3, 4, 5}) {
+        auto population = random_population(pop_size, depth);
+        int num_random_variables = population[0]->subtree().size();
+        auto discr = fb.discretize_population_symbols(population, num_random_variables);
+        long long num_pairs = (long long) num_random_variables * (num_random_variables + 1) / 2;
+        auto p = params({{"pop", pop_size}, {"depth", depth}, {"genotype_length", num_random_variables}});
+        run("compute_MI", p, num_pairs, "pairs", [&]() {
+          fb.compute_MI(discr.first, discr.second, num_random_variables);
+        });
+        Mat MI = fb.compute_MI(discr.first, discr.second, num_random_variables);
+        run("fast_upgma", p, num_random_variables, "variables", [&]() {
+          fb.fast_upgma(MI);
+        });
+        clear(population);
+      }
+    }
+  }
+
+  void gom() {
+    auto Xy = synthetic_data(1000, 10);
+    set_data(Xy.first, Xy.second);
+    for(int depth : {3, 4}) {
+      auto population = random_population(256, depth);
+      g::fit_func->get_fitnesses(population);
+      FOSBuilder fb;
+      auto fos = fb.build_linkage_tree(population);
+      int i = 0;
+      run("efficient_gom", params({{"rows", 1000}, {"depth", depth}, {"pop", 256}}), 1, "individuals", [&]() {
+        Node * offspring = efficient_gom(population[i], population, fos);
+        offspring->clear();
+        i = (i + 1) % population.size();
+      });
+      clear(population);
+    }
+  }
+
+  void clone_clear() {
+    for(int depth : {3, 5, 7}) {
+      auto population = random_population(64, depth);
+      long long num_nodes = 0;
+      for(Node * n : population)
+        num_nodes += n->subtree().size();
+      run("clone_clear", params({{"depth", depth}, {"trees", 64}}), num_nodes, "nodes", [&]() {
+        for(Node * n : population)
+          n->clone()->clear();
+      });
+      clear(population);
+    }
+  }
+
+  void update_elites() {
+    auto Xy = synthetic_data(1000, 10);
+    set_data(Xy.first, Xy.second);
+    for(int pop_size : {256, 1024}) {
+      auto population = random_population(pop_size, 4);
+      g::fit_func->get_fitnesses(population);
+      run("update_elites", params({{"pop", pop_size}, {"depth", 4}}), pop_size, "individuals", [&]() {
+        IMS ims;
+        ims.update_elites(population);
+      });
+      clear(population);
+    }
+  }
+
+  void load_csv() {
+    for(int rows : {1000, 10000}) {
+      auto Xy = synthetic_data(rows, 10);
+      string path = "gpg_bench_" + to_string(rows) + ".csv";
+      ofstream f(path);
+      for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < Xy.first.cols(); j++)
+          f << Xy.first(i, j) << ",";
+        f << Xy.second[i] << "\n";
+      }
+      f.close();
+      run("load_csv", params({{"rows", rows}, {"cols", 11}}), rows, "rows", [&]() {
+        ::load_csv(path);
+      });
+      remove(path.c_str());
+    }
+  }
+
+}
+
+int main(int argc, char** argv) {
+  // split bench options from gpg options
+  vector<char*> gpg_argv = {argv[0]};
+  for(int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.rfind("-bench_", 0) == 0) {
+      if (i + 1 >= argc)
+        throw runtime_error("Missing value for "+arg);
+      string value = argv[++i];
+      if (arg == "-bench_filter")
+        bench::filter = value;
+      else if (arg == "-bench_min_time")
+        bench::min_time = stod(value);
+      else if (arg == "-bench_out")
+        bench::out_path = value;
+      else
+        throw runtime_error("Unrecognized option: "+arg);
+    } else {
+      gpg_argv.push_back(argv[i]);
+    }
+  }
+  string lib = "-lib";
+  gpg_argv.push_back((char*) lib.c_str());
+
+  g::read_options(gpg_argv.size(), gpg_argv.data());
+
+  ofstream out_file;
+  if (!bench::out_path.empty()) {
+    out_file.open(bench::out_path);
+    bench::out = &out_file;
+    bench::csv = bench::out_path.size() >= 4 && bench::out_path.substr(bench::out_path.size() - 4) == ".csv";
+  }
+  if (bench::csv)
+    *bench::out << "kernel,params,reps,seconds_per_call,calls_per_second,items_per_second,item_unit\n";
+
+  // terminals are derived from the data
+  auto Xy = bench::synthetic_data(1000, 10);
+  bench::set_data(Xy.first, Xy.second);
+
+  bench::get_output();
+  bench::fitness();
+  bench::linkage();
+  bench::gom();
+  bench::clone_clear();
+  bench::update_elites();
+  bench::load_csv();
+
+  g::clear_globals();
+}
@@ -0,0 +1,266 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+#include "globals.hpp"
+#include "util.hpp"
+#include "myeig.hpp"
+#include "rng.hpp"
+#include "session.hpp"
+#include "profiling.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  End-to-end time-to-target benchmark (option `-ttt`).
+  For each data set and seed, the IMS is run with the configured budget and, at the end of
+  every macro generation, the best (search) fitness is recorded together with the wall time,
+  the evaluations, and the node evaluations spent so far. This gives an anytime curve per run and,
+  for each fitness target, the cost to reach it. Targets are relative to the fitness of the mean
+  predictor on the data set (1.0 for `ac`, for which constants are penalized).
+  Records are written as JSON lines to `-ttt_out`; a summary aggregated over seeds goes to stderr.
+*/
+
+namespace ttt {
+
+  struct Point {
+    int macro_generation;
+    double seconds;
+    long long evaluations;
+    long long node_evaluations;
+    float best_fitness;
+  };
+
+  struct Run {
+    string dataset;
+    int seed;
+    float reference_fitness; // of the mean predictor
+    vector<float> targets; // absolute
+    vector<Point> curve;
+    vector<int> hit; // for each target, index in curve where it was first reached (-1 if never)
+  };
+
+  // Feynman-style equations, variables sampled uniformly in [1, 5] as in the Feynman SR data sets
+  inline pair<Mat, Vec> feynman(string eq, int n) {
+    map<string, int> num_vars = {
+      {"I.6.2a", 1}, {"I.12.1", 2}, {"I.14.3", 3}, {"I.18.4", 4}, {"I.34.8", 4}, {"I.9.18", 9}
+    };
+    if (num_vars.find(eq) == num_vars.end())
+      throw runtime_error("Unrecognized Feynman equation: "+eq);
+
+    // the data must not depend on the seed of the runs, nor on the standard library (as std::hash would)
+    map<string, int> data_seeds = {
+      {"I.6.2a", 62}, {"I.12.1", 121}, {"I.14.3", 143}, {"I.18.4", 184}, {"I.34.8", 348}, {"I.9.18", 918}
+    };
+    Rng::set_seed(data_seeds[eq]);
+    Rng::set_stream(0);
+    Mat X = Rng::randu_mat(n, num_vars[eq]) * 4 + 1;
+    Vec y;
+    if (eq == "I.6.2a")
+      y = (-X.col(0).square() / 2).exp() / sqrt(2 * M_PI);
+    else if (eq == "I.12.1")
+      y = X.col(0) * X.col(1);
+    else if (eq == "I.14.3")
+      y = X.col(0) * X.col(1) * X.col(2);
+    else if (eq == "I.18.4")
+      y = (X.col(0) * X.col(1) + X.col(2) * X.col(3)) / (X.col(0) + X.col(2));
+    else if (eq == "I.34.8")
+      y = X.col(0) * X.col(1) * X.col(2) / X.col(3);
+    else // I.9.18
+      y = X.col(0) * X.col(1) * X.col(2) / ((X.col(4) - X.col(3)).square() + (X.col(6) - X.col(5)).square() + (X.col(8) - X.col(7)).square());
+    return make_pair(X, y);
+  }
+
+  // A data set is a path to a CSV file (last column is the target) or feynman_<eq>[:<rows>]
+  inline pair<Mat, Vec> load_dataset(string spec) {
+    if (spec.rfind("feynman_", 0) == 0) {
+      string eq = spec.substr(8);
+      int n = 1000;
+      auto colon = eq.find(':');
+      if (colon != string::npos) {
+        n = stoi(eq.substr(colon + 1));
+        eq = eq.substr(0, colon);
+      }
+      return feynman(eq, n);
+    }
+    if (!exists(spec))
+      throw runtime_error("Data set not found at path "+spec);
+    Mat Xy = load_csv(spec);
+    Mat X = remove_column(Xy, Xy.cols()-1);
+    Vec y = Xy.col(Xy.cols()-1);
+    return make_pair(X, y);
+  }
+
+  inline float reference_fitness(Mat & X, Vec & y) {
+    Node * mean_predictor = new Node(new Const(y.mean()));
+    float fitness = g::fit_func->get_fitness(mean_predictor, X, y);
+    mean_predictor->clear();
+    if (!isfinite(fitness))
+      fitness = 1.0;
+    return fitness;
+  }
+
+  inline string point_json(Point & p) {
+    stringstream ss;
+    ss << "{\"macro_generation\": " << p.macro_generation << ", \"seconds\": " << p.seconds << ", \"evaluations\": "
+      << p.evaluations << ", \"node_evaluations\": " << p.node_evaluations << ", \"best_fitness\": " << p.best_fitness << "}";
+    return ss.str();
+  }
+
+  inline string run_json(Run & r) {
+    stringstream ss;
+    Point & last = r.curve.back();
+    ss << "{\"type\": \"run\", \"dataset\": \"" << r.dataset << "\", \"seed\": " << r.seed
+      << ", \"seconds\": " << last.seconds << ", \"evaluations\": " << last.evaluations
+      << ", \"node_evaluations\": " << last.node_evaluations << ", \"best_fitness\": " << last.best_fitness
+      << ", \"evaluations_per_second\": " << last.evaluations / last.seconds
+      << ", \"node_evaluations_per_second\": " << last.node_evaluations / last.seconds << ", \"targets\": [";
+    for(int t = 0; t < r.targets.size(); t++) {
+      ss << (t > 0 ? ", " : "") << "{\"target\": " << r.targets[t] << ", \"relative_target\": " << r.targets[t] / r.reference_fitness << ", \"reached\": " << (r.hit[t] >= 0 ? "true" : "false");
+      if (r.hit[t] >= 0) {
+        Point & p = r.curve[r.hit[t]];
+        ss << ", \"macro_generation\": " << p.macro_generation << ", \"seconds\": " << p.seconds
+          << ", \"evaluations\": " << p.evaluations << ", \"node_evaluations\": " << p.node_evaluations;
+      }
+      ss << "}";
+    }
+    ss << "], \"anytime\": [";
+    for(int i = 0; i < r.curve.size(); i++)
+      ss << (i > 0 ? ", " : "") << point_json(r.curve[i]);
+    ss << "]}";
+    return ss.str();
+  }
+
+  inline float median_of(vector<float> values) {
+    sort(values.begin(), values.end());
+    int n = values.size();
+    if (n % 2 == 0)
+      return 0.5 * (values[n/2 - 1] + values[n/2]);
+    return values[n/2];
+  }
+
+  // Summary over the seeds of a data set
+  inline string summary_json(string dataset, float ref, vector<float> & rel_targets, vector<Run> & runs) {
+    stringstream ss;
+    vector<float> throughput, node_throughput;
+    for(Run & r : runs) {
+      throughput.push_back(r.curve.back().evaluations / r.curve.back().seconds);
+      node_throughput.push_back(r.curve.back().node_evaluations / r.curve.back().seconds);
+    }
+    ss << "{\"type\": \"summary\", \"dataset\": \"" << dataset << "\", \"runs\": " << runs.size()
+      << ", \"median_evaluations_per_second\": " << median_of(throughput)
+      << ", \"median_node_evaluations_per_second\": " << median_of(node_throughput) << ", \"targets\": [";
+    for(int t = 0; t < rel_targets.size(); t++) {
+      vector<float> seconds, evaluations, node_evaluations;
+      for(Run & r : runs) {
+        if (r.hit[t] < 0)
+          continue;
+        Point & p = r.curve[r.hit[t]];
+        seconds.push_back(p.seconds);
+        evaluations.push_back(p.evaluations);
+        node_evaluations.push_back(p.node_evaluations);
+      }
+      ss << (t > 0 ? ", " : "") << "{\"relative_target\": " << rel_targets[t] << ", \"success_rate\": " << seconds.size() / (float) runs.size();
+      if (!seconds.empty()) {
+        ss << ", \"median_seconds\": " << median_of(seconds) << ", \"median_evaluations\": " << median_of(evaluations)
+          << ", \"median_node_evaluations\": " << median_of(node_evaluations);
+      }
+      ss << "}";
+    }
+    // anytime curve: median over the runs that performed each macro generation
+    ss << "], \"anytime\": [";
+    for(int m = 0; ; m++) {
+      vector<float> seconds, evaluations, node_evaluations, best_fitness;
+      for(Run & r : runs) {
+        if (m >= r.curve.size())
+          continue;
+        seconds.push_back(r.curve[m].seconds);
+        evaluations.push_back(r.curve[m].evaluations);
+        node_evaluations.push_back(r.curve[m].node_evaluations);
+        best_fitness.push_back(r.curve[m].best_fitness / ref);
+      }
+      if (seconds.empty())
+        break;
+      ss << (m > 0 ? ", " : "") << "{\"macro_generation\": " << m + 1 << ", \"runs\": " << seconds.size()
+        << ", \"median_seconds\": " << median_of(seconds) << ", \"median_evaluations\": " << median_of(evaluations)
+        << ", \"median_node_evaluations\": " << median_of(node_evaluations)
+        << ", \"median_relative_best_fitness\": " << median_of(best_fitness) << "}";
+    }
+    ss << "]}";
+    return ss.str();
+  }
+
+  inline void run_benchmark() {
+    vector<string> datasets = split_string(g::ttt_datasets);
+    vector<float> rel_targets;
+    for(string & t : split_string(g::ttt_targets))
+      rel_targets.push_back(stof(t));
+    if (rel_targets.empty())
+      throw runtime_error("No targets for the time-to-target benchmark");
+    int first_seed = g::random_state >= 0 ? g::random_state : 1;
+
+    ofstream out;
+    if (!g::ttt_out.empty()) {
+      out.open(g::ttt_out);
+      if (!out.is_open())
+        throw runtime_error("Cannot open the benchmark output file: "+g::ttt_out);
+    }
+
+    Session session;
+    for(string & dataset : datasets) {
+      auto Xy = load_dataset(dataset);
+      float ref = reference_fitness(Xy.first, Xy.second);
+
+      vector<Run> runs;
+      for(int s = 0; s < g::ttt_seeds; s++) {
+        Run r;
+        r.dataset = dataset;
+        r.seed = first_seed + s;
+        r.reference_fitness = ref;
+        for(float rt : rel_targets)
+          r.targets.push_back(rt * ref);
+        r.hit = vector<int>(rel_targets.size(), -1);
+
+        g::random_state = r.seed;
+        Rng::set_seed(r.seed);
+        auto start = prof::now();
+        session.on_macro_generation = [&](IMS & ims) {
+          Point p;
+          p.macro_generation = ims.macro_generations;
+          p.seconds = prof::elapsed(start);
+          p.evaluations = g::fit_func->evaluations;
+          p.node_evaluations = g::fit_func->node_evaluations;
+          p.best_fitness = ims.select_elite(0.0)->fitness;
+          r.curve.push_back(p);
+          for(int t = 0; t < r.targets.size(); t++)
+            if (r.hit[t] < 0 && p.best_fitness <= r.targets[t])
+              r.hit[t] = r.curve.size() - 1;
+        };
+        session.fit(Xy.first, Xy.second);
+        if (r.curve.empty())
+          continue;
+
+        if (out.is_open())
+          out << run_json(r) << endl;
+        runs.push_back(r);
+      }
+      if (runs.empty())
+        continue;
+
+      string summary = summary_json(dataset, ref, rel_targets, runs);
+      if (out.is_open())
+        out << summary << endl;
+      cerr << summary << endl;
+    }
+  }
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include <atomic>
+#include <algorithm>
+
+#include "gpg.h"
+#include "globals.hpp"
+#include "session.hpp"
+#include "program.hpp"
+#include "complexity.hpp"
+
+using namespace std;
+using namespace myeig;
+
+typedef Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMat;
+
+struct gpg_context {
+  Session * session = NULL;
+  Mat X;
+  Vec y;
+  atomic<bool> stop_requested{false};
+
+  // snapshot of the elites of the last run, sorted by complexity
+  struct Elite {
+    Node * tree;
+    float complexity;
+    string repr;
+    string program;
+  };
+  vector<Elite> elites;
+
+  void clear_elites() {
+    for (Elite & e : elites)
+      e.tree->clear();
+    elites.clear();
+  }
+
+  ~gpg_context() {
+    clear_elites();
+    if (session)
+      delete session;
+  }
+};
+
+namespace {
+
+  thread_local string last_error;
+  atomic<bool> context_exists{false};
+
+  int fail(const string & message) {
+    last_error = message;
+    return -1;
+  }
+
+  // Runs f, converting exceptions into the error code of the C API
+  template<typename F>
+  int guarded(F f) {
+    try {
+      f();
+      return 0;
+    } catch (exception & e) {
+      return fail(e.what());
+    } catch (...) {
+      return fail("Unknown error");
+    }
+  }
+
+  Mat to_mat(const float * X, int n_rows, int n_cols) {
+    return Eigen::Map<const RowMajorMat>(X, n_rows, n_cols);
+  }
+
+  int check_elite(gpg_context * ctx, int elite_idx) {
+    if (!ctx)
+      return fail("No context");
+    if (elite_idx < 0 || elite_idx >= ctx->elites.size())
+      return fail("Elite index out of range: "+to_string(elite_idx));
+    return 0;
+  }
+
+}
+
+extern "C" {
+
+int gpg_api_version(void) {
+  return GPG_API_VERSION;
+}
+
+const char * gpg_last_error(void) {
+  return last_error.c_str();
+}
+
+gpg_context * gpg_create(const char * options) {
+  bool expected = false;
+  if (!context_exists.compare_exchange_strong(expected, true)) {
+    fail("Only one context can exist at a time (the configuration is process-global)");
+    return NULL;
+  }
+  gpg_context * ctx = new gpg_context();
+  // the data is passed with `gpg_set_data`
+  int status = guarded([&]() {
+    string opts = options ? string(options) : "";
+    ctx->session = new Session(opts.empty() ? "-lib" : opts + " -lib");
+  });
+  if (status != 0) {
+    delete ctx;
+    context_exists = false;
+    return NULL;
+  }
+  return ctx;
+}
+
+void gpg_destroy(gpg_context * ctx) {
+  if (!ctx)
+    return;
+  delete ctx;
+  context_exists = false;
+}
+
+int gpg_set_data(gpg_context * ctx, const float * X, const float * y, int n_rows, int n_cols) {
+  if (!ctx)
+    return fail("No context");
+  if (!X || !y || n_rows <= 0 || n_cols <= 0)
+    return fail("Invalid data");
+  return guarded([&]() {
+    ctx->X = to_mat(X, n_rows, n_cols);
+    ctx->y = Eigen::Map<const Vec>(y, n_rows);
+  });
+}
+
+int gpg_run(gpg_context * ctx, double budget) {
+  if (!ctx)
+    return fail("No context");
+  if (ctx->X.size() == 0)
+    return fail("No data, call gpg_set_data first");
+  if (budget <= 0)
+    return fail("The budget must be positive");
+
+  ctx->stop_requested = false;
+  g::interrupt_check = [ctx]() { return ctx->stop_requested.load(); };
+  int status = guarded([&]() {
+    ctx->session->continue_fit(ctx->X, ctx->y, budget);
+
+    ctx->clear_elites();
+    for (auto it = ctx->session->ims->final_elites.begin(); it != ctx->session->ims->final_elites.end(); it++) {
+      gpg_context::Elite e;
+      e.tree = it->second->clone();
+      e.complexity = it->first;
+      e.repr = e.tree->human_repr();
+      e.program = serialize_program(e.tree);
+      ctx->elites.push_back(e);
+    }
+    sort(ctx->elites.begin(), ctx->elites.end(), [](const gpg_context::Elite & a, const gpg_context::Elite & b) {
+      return a.complexity < b.complexity;
+    });
+  });
+  g::interrupt_check = nullptr;
+  return status;
+}
+
+int gpg_reset(gpg_context * ctx) {
+  if (!ctx)
+    return fail("No context");
+  return guarded([&]() {
+    // keeps the configuration, drops the search state
+    if (ctx->session->ims) {
+      delete ctx->session->ims;
+      ctx->session->ims = NULL;
+    }
+    ctx->clear_elites();
+  });
+}
+
+void gpg_request_stop(gpg_context * ctx) {
+  if (ctx)
+    ctx->stop_requested = true;
+}
+
+int gpg_num_elites(gpg_context * ctx) {
+  if (!ctx)
+    return fail("No context");
+  return ctx->elites.size();
+}
+
+const char * gpg_elite_repr(gpg_context * ctx, int elite_idx) {
+  if (check_elite(ctx, elite_idx) != 0)
+    return NULL;
+  return ctx->elites[elite_idx].repr.c_str();
+}
+
+int gpg_elite_scores(gpg_context * ctx, int elite_idx, float * fitness, float * complexity) {
+  if (check_elite(ctx, elite_idx) != 0)
+    return -1;
+  if (fitness)
+    *fitness = ctx->elites[elite_idx].tree->fitness;
+  if (complexity)
+    *complexity = ctx->elites[elite_idx].complexity;
+  return 0;
+}
+
+int gpg_elite_program(gpg_context * ctx, int elite_idx, const char ** program, size_t * length) {
+  if (check_elite(ctx, elite_idx) != 0)
+    return -1;
+  if (!program || !length)
+    return fail("Invalid output arguments");
+  *program = ctx->elites[elite_idx].program.data();
+  *length = ctx->elites[elite_idx].program.size();
+  return 0;
+}
+
+int gpg_evaluate(gpg_context * ctx, int elite_idx, const float * X, int n_rows, int n_cols, float * out) {
+  if (check_elite(ctx, elite_idx) != 0)
+    return -1;
+  const string & program = ctx->elites[elite_idx].program;
+  return gpg_evaluate_program(program.data(), program.size(), X, n_rows, n_cols, out, 1);
+}
+
+int gpg_evaluate_program(const char * program, size_t length, const float * X, int n_rows, int n_cols, float * out, int num_threads) {
+  if (!program || !X || !out || n_rows < 0 || n_cols <= 0)
+    return fail("Invalid arguments");
+  return guarded([&]() {
+    Mat X_mat = to_mat(X, n_rows, n_cols);
+    Vec result = predict_batch(string(program, length), X_mat, num_threads);
+    Eigen::Map<Vec>(out, n_rows) = result;
+  });
+}
+
+}
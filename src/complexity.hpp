@@ -5,7 +5,7 @@
 #include "operator.hpp"
 #include "globals.hpp"
 
-float compute_complexity(Node * tree) {
+inline float compute_complexity(Node * tree) {
   if (g::complexity_type == "node_count") {
     return tree->get_num_nodes(true);
   } 
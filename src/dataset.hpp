@@ -0,0 +1,220 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "myeig.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Layout of the data the evaluations read (option `-pad_data`).
+  The rows of the batch are padded to a multiple of SIMD_FLOATS (16 floats, i.e., a 64-byte cache
+  line, or an AVX-512 register), so that the vectorized kernels of the operators have no scalar tail,
+  and every column spans whole cache lines. With dynamic Eigen arrays aligned to 64 bytes
+  (`EIGEN_MAX_ALIGN_BYTES=64`, set by CMakeLists.txt), each column then starts on a cache line.
+  Padding rows repeat the last real row, so that they hold valid inputs (no spurious NaNs or
+  denormals); only X is padded, the targets are not, and Fitness::set_fitness drops the padding rows
+  of the outputs before computing the fitness, so that padding cannot affect any reduction.
+  Data sets of at least HUGE_PAGE_BYTES are advised to be backed by transparent huge pages, which
+  reduces TLB misses when the columns of multi-GB tables are streamed.
+
+  Reduced precision (option `-data_precision`): the batch can be stored with 16-bit floats
+  (bfloat16 or IEEE float16), which halves the memory and the bandwidth per row. Two features share
+  one 32-bit slot of the (float) matrix, i.e., column k holds feature 2k in its low and feature
+  2k+1 in its high 16 bits, so that the packed batch is still a Mat with one row per observation
+  and can be copied, replicated, and shared like any other. Features are widened to float32 on
+  load (see `feature`, used by the Feat operator), and everything else is computed in float32.
+  Whether the matrix being evaluated is packed is set per thread with `PackedScope` by Fitness.
+  Inputs lose precision (about 3 significant digits for bfloat16, 3-4 for float16, which also
+  overflows above 65504), so Fitness computes the final fitnesses in float32.
+*/
+
+namespace dataset {
+
+  const int SIMD_FLOATS = 16;
+  const size_t CACHE_LINE_BYTES = 64;
+  const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+  inline bool pad = false;
+
+  inline int padded_rows(int rows) {
+    return (rows + SIMD_FLOATS - 1) / SIMD_FLOATS * SIMD_FLOATS;
+  }
+
+  // Whether every column of X starts on a cache line
+  inline bool cache_line_aligned(Mat & X) {
+    return (uintptr_t) X.data() % CACHE_LINE_BYTES == 0 && (X.rows() * sizeof(float)) % CACHE_LINE_BYTES == 0;
+  }
+
+  // Advises the kernel to back the (2MB-aligned) interior of the given memory with huge pages;
+  // returns whether there was something to advise
+  inline bool advise_huge_pages(void * data, size_t num_bytes) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    uintptr_t begin = ((uintptr_t) data + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    uintptr_t end = ((uintptr_t) data + num_bytes) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    if (end <= begin)
+      return false;
+    return madvise((void*) begin, end - begin, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+  }
+
+  enum Precision {
+    dpFloat32, dpBFloat16, dpFloat16
+  };
+
+  inline const char * precision_names[] = {"float32", "bfloat16", "float16"};
+
+  inline Precision precision = dpFloat32; // of the batch
+
+  inline Precision parse_precision(string name) {
+    for (int p = dpFloat32; p <= dpFloat16; p++)
+      if (name == precision_names[p])
+        return (Precision) p;
+    throw runtime_error("Unrecognized data precision: "+name+" (use float32, bfloat16, or float16)");
+  }
+
+  inline uint16_t to_bfloat16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(float));
+    if ((u & 0x7FFFFFFF) > 0x7F800000) // NaN, keep it quiet
+      return (u >> 16) | 0x40;
+    return (u + 0x7FFF + ((u >> 16) & 1)) >> 16; // round to nearest even
+  }
+
+  inline uint16_t to_float16(float f) {
+    // round to nearest even, after F. Giesen's float_to_half_fast3
+    uint32_t u;
+    memcpy(&u, &f, sizeof(float));
+    uint32_t sign = u & 0x80000000;
+    u ^= sign;
+    uint16_t h;
+    if (u >= 0x47800000) { // overflow: inf, or NaN
+      h = u > 0x7F800000 ? 0x7E00 : 0x7C00;
+    } else if (u < 0x38800000) { // subnormal or zero
+      float g, denorm_magic = 0.5f;
+      memcpy(&g, &u, sizeof(float));
+      g += denorm_magic;
+      uint32_t v;
+      memcpy(&v, &g, sizeof(float));
+      h = v - 0x3F000000;
+    } else {
+      uint32_t mant_odd = (u >> 13) & 1;
+      u += 0xC8000FFF + mant_odd; // rebias the exponent & round
+      h = u >> 13;
+    }
+    return h | (sign >> 16);
+  }
+
+  inline float from_float16(uint16_t h) {
+    // after F. Giesen's half_to_float_fast4
+    uint32_t o = (h & 0x7FFF) << 13;
+    uint32_t exp = o & 0x0F800000;
+    o += 0x38000000; // exponent adjust
+    if (exp == 0x0F800000) { // inf or NaN
+      o += 0x38000000;
+    } else if (exp == 0) { // zero or subnormal, renormalize
+      o += 0x00800000;
+      float f, magic = 6.103515625e-05f; // 2^-14
+      memcpy(&f, &o, sizeof(float));
+      f -= magic;
+      memcpy(&o, &f, sizeof(float));
+    }
+    o |= (uint32_t) (h & 0x8000) << 16;
+    float f;
+    memcpy(&f, &o, sizeof(float));
+    return f;
+  }
+
+  // Packs the features of X in 16 bits, two per column (see above)
+  inline Mat packed(Mat & X, Precision p) {
+    int rows = X.rows(), cols = X.cols();
+    Mat P = Mat::Zero(rows, (cols + 1) / 2);
+    uint32_t * slots = (uint32_t*) P.data();
+    for (int j = 0; j < cols; j++) {
+      int shift = j % 2 == 0 ? 0 : 16;
+      uint32_t * col = slots + (size_t) (j / 2) * rows;
+      for (int i = 0; i < rows; i++) {
+        uint16_t h = p == dpBFloat16 ? to_bfloat16(X(i, j)) : to_float16(X(i, j));
+        col[i] |= (uint32_t) h << shift;
+      }
+    }
+    return P;
+  }
+
+  // Widens feature id of the packed X to float32
+  inline Vec unpacked_feature(const MatRef & X, int id, Precision p) {
+    int rows = X.rows();
+    Vec out(rows);
+    const uint32_t * col = (const uint32_t*) X.data() + (size_t) (id / 2) * X.outerStride();
+    uint32_t * dst = (uint32_t*) out.data();
+    if (p == dpBFloat16) {
+      // a bfloat16 is the upper half of a float32: a shift or a mask, which vectorizes
+      if (id % 2 == 0) {
+        for (int i = 0; i < rows; i++)
+          dst[i] = col[i] << 16;
+      } else {
+        for (int i = 0; i < rows; i++)
+          dst[i] = col[i] & 0xFFFF0000;
+      }
+    } else {
+      int shift = id % 2 == 0 ? 0 : 16;
+      for (int i = 0; i < rows; i++)
+        out[i] = from_float16((col[i] >> shift) & 0xFFFF);
+    }
+    return out;
+  }
+
+  inline Precision & _input_precision() {
+    thread_local Precision p = dpFloat32;
+    return p;
+  }
+
+  // Sets the precision of the matrices evaluated by the calling thread while in scope
+  struct PackedScope {
+    Precision previous;
+
+    PackedScope(Precision p) {
+      previous = _input_precision();
+      _input_precision() = p;
+    }
+
+    ~PackedScope() {
+      _input_precision() = previous;
+    }
+  };
+
+  // Feature id of X (as float32), which is packed if the calling thread is in a PackedScope
+  inline Vec feature(const MatRef & X, int id) {
+    Precision p = _input_precision();
+    if (p == dpFloat32)
+      return X.col(id);
+    return unpacked_feature(X, id, p);
+  }
+
+  // Returns X with its rows padded to a multiple of SIMD_FLOATS (repeating the last row)
+  inline Mat padded(Mat & X) {
+    int rows = X.rows();
+    int num_padding = padded_rows(rows) - rows;
+    Mat P(rows + num_padding, X.cols());
+    if (P.size() * sizeof(float) >= HUGE_PAGE_BYTES)
+      advise_huge_pages(P.data(), P.size() * sizeof(float)); // before the pages are touched
+    P.topRows(rows) = X;
+    if (num_padding > 0) // (then rows > 0)
+      P.bottomRows(num_padding) = X.row(rows - 1).replicate(num_padding, 1);
+    return P;
+  }
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef EVALUATION_POOL_H
+#define EVALUATION_POOL_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "myeig.hpp"
+#include "node.hpp"
+#include "program.hpp"
+#include "dataset.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Pool of forked worker processes that evaluate the fitness of trees (option `-eval_workers`),
+  for when evaluations are very expensive (e.g., huge data sets).
+  The current (mini) batch lives in a shared mapping created before forking, which the workers
+  map read-only and evaluate on in place; the search publishes a new version there whenever the
+  batch changes, which the workers see from the next request on. Requests carry the serialised program of a
+  tree (see program.hpp) over a pipe per worker and are answered with the fitness.
+  `submit` queues a request (to the least loaded worker) and returns immediately, `flush` sends
+  the queued requests of each worker with a single write, and `collect` applies the fitnesses
+  that came back, so that several evaluations can be in flight; workers answer all the requests
+  they have received before they block again. The number of requests in flight per worker is
+  bounded, which keeps pipes from filling up in both directions.
+  The pool is driven by the search thread only (it is not thread-safe).
+*/
+
+namespace evalpool {
+
+  const int MAX_IN_FLIGHT = 64; // per worker
+
+  struct SharedBatch {
+    atomic<uint64_t> version;
+    int rows;
+    int cols;
+    int y_rows; // fewer than rows if X is padded (see dataset.hpp)
+    int precision; // of X, packed if not float32 (see dataset.hpp)
+    // followed by X (column-major) and y
+  };
+
+  struct Request {
+    uint32_t id;
+    uint32_t num_bytes;
+  };
+
+  struct Reply {
+    uint32_t id;
+    float fitness;
+  };
+
+  struct Worker {
+    pid_t pid;
+    int to_fd;
+    int from_fd;
+    int in_flight = 0;
+    string send_buffer;
+    string recv_buffer;
+  };
+
+  inline int num_workers = 0; // 0: evaluations are not offloaded
+
+  inline vector<Worker> workers;
+  inline SharedBatch * shared = NULL;
+  inline size_t shared_bytes = 0;
+  inline int capacity_rows = 0, capacity_cols = 0;
+  inline const void * owner = NULL; // the fitness function the workers evaluate with
+
+  inline uint32_t next_id = 0;
+  // requests in flight: the tree, and where to store the unrounded fitness (can be NULL)
+  inline unordered_map<uint32_t, pair<Node*, float*>> pending;
+  // how the workers compute the (unrounded) fitness of a tree
+  inline function<float(Node*, const MatRef&, const VecRef&)> evaluate_fn;
+
+  inline float * _shared_X() {
+    return (float*) ((char*) shared + sizeof(SharedBatch));
+  }
+
+  inline float * _shared_y() {
+    return _shared_X() + (size_t) capacity_rows * capacity_cols;
+  }
+
+  inline void _write_all(int fd, const char * data, size_t num_bytes) {
+    while (num_bytes > 0) {
+      ssize_t written = write(fd, data, num_bytes);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        throw runtime_error(string("Cannot reach an evaluation worker: ") + strerror(errno));
+      data += written;
+      num_bytes -= written;
+    }
+  }
+
+  [[noreturn]] inline void _worker_loop(int in_fd, int out_fd) {
+    string in, out;
+    size_t pos = 0;
+    char chunk[1 << 16];
+
+    // makes n bytes available in `in` from `pos`, answering what was processed before blocking
+    auto ensure = [&](size_t n) {
+      while (in.size() - pos < n) {
+        if (!out.empty()) {
+          _write_all(out_fd, out.data(), out.size());
+          out.clear();
+        }
+        ssize_t r = read(in_fd, chunk, sizeof(chunk));
+        if (r < 0 && errno == EINTR)
+          continue;
+        if (r <= 0) // the search closed the pipe
+          _exit(0);
+        in.erase(0, pos);
+        pos = 0;
+        in.append(chunk, r);
+      }
+    };
+
+    try {
+      while (true) {
+        ensure(sizeof(Request));
+        Request req;
+        memcpy(&req, in.data() + pos, sizeof(Request));
+        ensure(sizeof(Request) + req.num_bytes);
+        string program = in.substr(pos + sizeof(Request), req.num_bytes);
+        pos += sizeof(Request) + req.num_bytes;
+
+        // evaluated in place (the acquire pairs with the release of `sync`, which publishes the batch)
+        shared->version.load(memory_order_acquire);
+        Eigen::Map<const Mat> X(_shared_X(), shared->rows, shared->cols);
+        Eigen::Map<const Vec> y(_shared_y(), shared->y_rows);
+
+        Node * tree = deserialize_program(program);
+        Reply reply;
+        reply.id = req.id;
+        {
+          dataset::PackedScope packed_scope((dataset::Precision) shared->precision);
+          reply.fitness = evaluate_fn(tree, X, y);
+        }
+        tree->clear();
+        out.append((char*) &reply, sizeof(Reply));
+      }
+    } catch (exception & e) {
+      fprintf(stderr, "evaluation worker %d failed: %s\n", getpid(), e.what());
+      _exit(1);
+    }
+  }
+
+  inline void stop() {
+    for (Worker & w : workers) {
+      close(w.to_fd); // the worker exits on EOF
+      close(w.from_fd);
+    }
+    for (Worker & w : workers)
+      waitpid(w.pid, NULL, 0);
+    workers.clear();
+    pending.clear();
+    if (shared)
+      munmap(shared, shared_bytes);
+    shared = NULL;
+    owner = NULL;
+  }
+
+  inline void start(const void * fitness, int rows, int cols, function<float(Node*, const MatRef&, const VecRef&)> fn) {
+    stop();
+    capacity_rows = rows;
+    capacity_cols = cols;
+    shared_bytes = sizeof(SharedBatch) + (size_t) rows * (cols + 1) * sizeof(float);
+    void * addr = mmap(NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+      throw runtime_error(string("Cannot map the data set for the evaluation workers: ") + strerror(errno));
+    shared = (SharedBatch*) addr;
+    shared->version = 0;
+    owner = fitness;
+    evaluate_fn = fn;
+
+    for (int i = 0; i < num_workers; i++) {
+      int to_worker[2], from_worker[2];
+      if (pipe(to_worker) != 0 || pipe(from_worker) != 0)
+        throw runtime_error(string("Cannot create the pipes of an evaluation worker: ") + strerror(errno));
+      pid_t pid = fork();
+      if (pid < 0)
+        throw runtime_error(string("Cannot fork an evaluation worker: ") + strerror(errno));
+      if (pid == 0) {
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        // keep only the own ends of the own pipes, so that the worker sees EOF when the search stops
+        for (Worker & w : workers) {
+          close(w.to_fd);
+          close(w.from_fd);
+        }
+        close(to_worker[1]);
+        close(from_worker[0]);
+        mprotect(addr, shared_bytes, PROT_READ);
+        _worker_loop(to_worker[0], from_worker[1]);
+      }
+      close(to_worker[0]);
+      close(from_worker[1]);
+      Worker w;
+      w.pid = pid;
+      w.to_fd = to_worker[1];
+      w.from_fd = from_worker[0];
+      workers.push_back(w);
+    }
+  }
+
+  // Publishes the batch to the workers if it changed (version), restarting them if it does not fit
+  inline void sync(const void * fitness, Mat & X, Vec & y, uint64_t version, int precision, int capacity_rows_hint,
+    function<float(Node*, const MatRef&, const VecRef&)> fn) {
+    if (!shared || owner != fitness || X.rows() > capacity_rows || X.cols() != capacity_cols)
+      start(fitness, max((int) X.rows(), capacity_rows_hint), X.cols(), fn);
+    if (shared->version.load(memory_order_relaxed) == version + 1)
+      return;
+    Eigen::Map<Mat>(_shared_X(), X.rows(), X.cols()) = X;
+    Eigen::Map<Vec>(_shared_y(), y.size()) = y;
+    shared->rows = X.rows();
+    shared->cols = X.cols();
+    shared->y_rows = y.size();
+    shared->precision = precision;
+    shared->version.store(version + 1, memory_order_release); // 0 is never published
+  }
+
+  inline void flush() {
+    for (Worker & w : workers) {
+      if (w.send_buffer.empty())
+        continue;
+      _write_all(w.to_fd, w.send_buffer.data(), w.send_buffer.size());
+      w.send_buffer.clear();
+    }
+  }
+
+  // Applies the fitnesses that came back; if block, waits for at least one. Returns how many were applied
+  inline int collect(bool block=true) {
+    flush();
+    if (pending.empty())
+      return 0;
+    vector<pollfd> fds(workers.size());
+    for (int i = 0; i < workers.size(); i++)
+      fds[i] = pollfd{workers[i].from_fd, POLLIN, 0};
+    int ready = poll(fds.data(), fds.size(), block ? -1 : 0);
+    if (ready < 0 && errno != EINTR)
+      throw runtime_error(string("Cannot wait for the evaluation workers: ") + strerror(errno));
+
+    int num_applied = 0;
+    char chunk[1 << 12];
+    for (int i = 0; i < workers.size() && ready > 0; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP)))
+        continue;
+      Worker & w = workers[i];
+      ssize_t r = read(w.from_fd, chunk, sizeof(chunk));
+      if (r == 0 || (r < 0 && errno != EINTR))
+        throw runtime_error("An evaluation worker terminated unexpectedly");
+      if (r < 0)
+        continue;
+      w.recv_buffer.append(chunk, r);
+      size_t pos = 0;
+      for (; pos + sizeof(Reply) <= w.recv_buffer.size(); pos += sizeof(Reply)) {
+        Reply reply;
+        memcpy(&reply, w.recv_buffer.data() + pos, sizeof(Reply));
+        auto it = pending.find(reply.id);
+        it->second.first->fitness = roundd(reply.fitness, NUM_PRECISION + 2);
+        if (it->second.second)
+          *it->second.second = reply.fitness;
+        pending.erase(it);
+        w.in_flight--;
+        num_applied++;
+      }
+      w.recv_buffer.erase(0, pos);
+    }
+    return num_applied;
+  }
+
+  // Queues the evaluation of tree, whose fitness is set by a later `collect` (and stored unrounded
+  // into raw_fitness, if given); returns the id of the request
+  inline uint32_t submit(Node * tree, float * raw_fitness=NULL) {
+    int best = 0;
+    for (int i = 1; i < workers.size(); i++)
+      if (workers[i].in_flight < workers[best].in_flight)
+        best = i;
+    while (workers[best].in_flight >= MAX_IN_FLIGHT)
+      collect(true);
+
+    Worker & w = workers[best];
+    string program = serialize_program(tree);
+    Request req;
+    req.id = next_id++;
+    req.num_bytes = program.size();
+    w.send_buffer.append((char*) &req, sizeof(Request));
+    w.send_buffer += program;
+    w.in_flight++;
+    pending[req.id] = make_pair(tree, raw_fitness);
+    return req.id;
+  }
+
+  // Evaluates tree, returns the unrounded fitness
+  inline float evaluate(Node * tree) {
+    float fitness;
+    uint32_t id = submit(tree, &fitness);
+    while (pending.find(id) != pending.end())
+      collect(true);
+    return fitness;
+  }
+
+  // Evaluates all trees, with the requests spread over the workers; returns the unrounded fitnesses
+  inline Vec evaluate(vector<Node*> & trees) {
+    Vec fitnesses(trees.size());
+    for (int i = 0; i < trees.size(); i++)
+      submit(trees[i], &fitnesses[i]);
+    while (!pending.empty())
+      collect(true);
+    return fitnesses;
+  }
+
+}
+
+#endif
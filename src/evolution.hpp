@@ -1,7 +1,6 @@
 #ifndef EVOLUTION_H
 #define EVOLUTION_H
 
-#include <Python.h>
 #include <unordered_map>
 
 #include "util.hpp"
@@ -33,7 +32,8 @@ struct Evolution {
 
   void clear_population(vector<Node*> & population) {
     for(auto * tree : population) {
-      tree->clear();
+      if (tree)
+        tree->clear();
     }
     population.clear();
   }
@@ -54,22 +54,27 @@ struct Evolution {
         continue;
       } 
       already_generated.insert(str_tree);
-      g::fit_func->get_fitness(tree);
       population.push_back(tree);
     }
+    // evaluate all at once, so that subtrees can be shared
+    g::fit_func->get_fitnesses(population);
   } 
 
   void gomea_generation() {
+    trace::Scope trace_scope("gomea_generation", "evolution");
+    trace_scope.arg("pop_size", pop_size);
     // build linkage tree fos
     auto fos = fb->build_linkage_tree(population);
 
-    // perform GOM
+    // perform GOM (the offspring coexist with their parents until the end of the generation)
+    mem::Scoped offspring_memory(mem::msPopulations, mem::measuring() ? mem::trees_bytes(population) : 0);
     vector<Node*> offspring_population; 
-    offspring_population.reserve(pop_size);
-    for(int i = 0; i < pop_size; i++) {
-      auto * offspring = efficient_gom(population[i], population, fos);
-      //check_n_set_elite(offspring);
-      offspring_population.push_back(offspring);
+    if (g::gom_window > 1) {
+      offspring_population = pipelined_gom(population, fos, g::gom_window);
+    } else {
+      // also with one thread, so that the result depends neither on the number of threads nor on 
+      // where evaluations happen (the worker pool is driven by the search thread only)
+      offspring_population = parallel_gom(population, fos, evalpool::num_workers > 0 ? 1 : g::num_threads);
     }
 
     // replace parent with offspring population
@@ -80,21 +85,28 @@ struct Evolution {
   }
 
   void ga_generation() {
-    vector<Node*> offspring_population; 
-    offspring_population.reserve(pop_size);
-    for(int i = 0; i < pop_size; i++) {
+    // each offspring draws from its own rng stream (as in parallel_gom), so that the result does not
+    // depend on the number of threads (one thread with the worker pool, which only the search thread drives)
+    int num_threads = evalpool::num_workers > 0 ? 1 : g::num_threads;
+    vector<Node*> offspring_population(pop_size, NULL);
+    uint64_t key = Rng::get()();
+    Xoshiro::Xoshiro256PP caller_rng = Rng::get();
+    parallel_for(pop_size, num_threads, [&](int i) {
+      Rng::set_stream(0, key + i + 1);
+      reset_sample_indices();
       auto * cr_offspring = crossover(population[i], population[Rng::randu()*population.size()]);
       auto * mut_offspring = mutation(cr_offspring, g::functions, g::terminals, 0.75);
       cr_offspring->clear();
       mut_offspring = coeff_mut(mut_offspring, false);
       // compute fitness
       g::fit_func->get_fitness(mut_offspring);
-      // add to off pop
-      offspring_population.push_back(mut_offspring);
-    }
+      offspring_population[i] = mut_offspring;
+    });
+    Rng::restore(caller_rng);
+    reset_sample_indices();
 
     // selection
-    auto selection = popwise_tournament(offspring_population, pop_size, g::tournament_size, g::tournament_stochastic);
+    auto selection = popwise_tournament(offspring_population, pop_size, g::tournament_size, g::tournament_stochastic, true);
     
     // clean up
     clear_population(population);
@@ -109,8 +121,8 @@ struct Evolution {
 
     /*
     for(int i = 0; i < g::max_generations; i++) {
-      if(g::_call_as_lib && PyErr_CheckSignals() == -1) {
-        exit(1);
+      if (g::interrupt_check && g::interrupt_check()) {
+        break;
       }
 
       // update mini batch
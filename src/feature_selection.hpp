@@ -2,11 +2,40 @@
 #define FEATURESELECTION_H
 
 #include "myeig.hpp"
+#include "util.hpp"
 
 using namespace std;
 using namespace myeig;
 
-Veci feature_selection(Mat & X, Vec & y, int to_retain=10) {
+// Returns the columns of X standardized to zero mean and unit norm (or all zeros if the column is constant),
+// so that the Pearson correlation between two columns is simply their dot product
+inline Mat _standardize_columns(Mat & X, int num_threads) {
+  Mat Z(X.rows(), X.cols());
+  parallel_for(X.cols(), num_threads, [&](int i) {
+    Z.col(i) = X.col(i) - X.col(i).mean();
+    float norm = sqrt(Z.col(i).square().sum());
+    if (norm == 0 || isnan(norm) || isinf(norm))
+      Z.col(i) = 0;
+    else
+      Z.col(i) /= norm;
+  });
+  return Z;
+}
+
+// Absolute Pearson correlation of all columns of (standardized) Z with column j, blocked over columns
+inline Vec _abs_corr_with_column(Mat & Z, int j, int num_threads, int block_size=256) {
+  int num_features = Z.cols();
+  Vec result(num_features);
+  int num_blocks = (num_features + block_size - 1) / block_size;
+  parallel_for(num_blocks, num_threads, [&](int b) {
+    int start = b * block_size;
+    int len = min(block_size, num_features - start);
+    result.segment(start, len) = (Z.middleCols(start, len).matrix().transpose() * Z.col(j).matrix()).array().abs();
+  });
+  return result;
+}
+
+inline Veci feature_selection(Mat & X, Vec & y, int to_retain=10, int num_threads=1) {
 
   int num_features = X.cols();
   Veci result;
@@ -25,24 +54,18 @@ Veci feature_selection(Mat & X, Vec & y, int to_retain=10) {
   // initialize result (indices of features to retain) to -1
   result = Veci::Zero(to_retain) - 1;
 
-  // pre-compute absolute spearman correlation to target
+  // pre-compute absolute spearman correlation to target (the ranking of y is shared)
   Vec ascs(num_features);
-  for(int i = 0; i < num_features; i++) {
+  Vec r_y = ranking(y).cast<float>();
+  parallel_for(num_features, num_threads, [&](int i) {
     Vec feat = X.col(i);
-    ascs[i] = abs(spearcorr(feat, y));
-  }
+    Vec r_feat = ranking(feat).cast<float>();
+    ascs[i] = abs(corr(r_feat, r_y));
+  });
 
-  // pre-compute inter-feature abs pearson correlation
-  Mat P(num_features,num_features);
-  for(int i = 0; i < num_features; i++) {
-    Vec feat_i = X.col(i);
-    for(int j = i+1; j < num_features; j++) {
-      Vec feat_j = X.col(j);
-      P(i,j) = abs(corr(feat_i, feat_j));
-      P(j,i) = P(i,j);
-    }
-    P(i,i) = 0.0; // do not consider corr w.r.t. itself
-  }
+  // inter-feature abs pearson correlations are computed only w.r.t. the features that get retained,
+  // i.e., one column of the correlation matrix at a time, from standardized features
+  Mat Z = _standardize_columns(X, num_threads);
 
   // initialize scores to abs spearson correlation
   Vec scores = ascs;
@@ -52,9 +75,12 @@ Veci feature_selection(Mat & X, Vec & y, int to_retain=10) {
   while(num_retained < to_retain) {
 
     // update scores by subtracting max abs pears corr with last inserted idx
-    if (best_sc_idx > 0)
+    if (best_sc_idx > 0) {
+      Vec P_best = _abs_corr_with_column(Z, best_sc_idx, num_threads);
+      P_best[best_sc_idx] = 0.0; // do not consider corr w.r.t. itself
       for(int i = 0; i < num_features; i++)
-        scores[i] = scores[i] > NINF ? scores[i] - P(i,best_sc_idx) / ((float)num_features) : scores[i];
+        scores[i] = scores[i] > NINF ? scores[i] - P_best[i] / ((float)num_features) : scores[i];
+    }
 
     // get next to include w.r.t. score
     best_sc_idx = argmax(scores);
@@ -70,4 +96,4 @@ Veci feature_selection(Mat & X, Vec & y, int to_retain=10) {
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -1,23 +1,42 @@
 #ifndef FITNESS_H
 #define FITNESS_H
 
+#include <atomic>
 #include <Eigen/Dense>
 #include "myeig.hpp"
 #include "node.hpp"
 #include "util.hpp"
 #include "rng.hpp"
+#include "batch_evaluation.hpp"
+#include "profiling.hpp"
+#include "tracing.hpp"
+#include "evaluation_pool.hpp"
+#include "numa.hpp"
+#include "dataset.hpp"
+#include "specialized.hpp"
+#include "jit.hpp"
 
 using namespace myeig;
 
 struct Fitness {
 
-  int evaluations = 0;
-  long long node_evaluations = 0;
+  // atomic, as individuals can be evaluated by several threads (see scheduler.hpp)
+  atomic<int> evaluations{0};
+  atomic<long long> node_evaluations{0};
+
+  // trees evaluated with get_fitnesses are hash-consed into a DAG in chunks of this size (<= 1 disables it)
+  int subtree_sharing_batch = 256;
 
   virtual ~Fitness() {};
 
   Mat X_train, X_val, X_batch;
   Vec y_train, y_val, y_batch;
+  uint64_t batch_version = 0; // changes whenever the batch is (re-)set
+  uint64_t train_version = 0; // changes whenever the training set is (re-)set
+  dataset::Precision batch_precision = dataset::dpFloat32; // X_batch is packed if not float32 (see dataset.hpp)
+  Veci batch_rows; // rows of the training set in the batch, empty if all
+  // per-node copies of the data evaluations read (see numa.hpp)
+  numa::Replicas batch_replicas, train_replicas;
 
   virtual string name() {
     throw runtime_error("Not implemented");
@@ -27,39 +46,129 @@ struct Fitness {
     throw runtime_error("Not implemented");
   }
 
-  virtual float get_fitness(Node * n, Mat & X, Vec & y) {
+  virtual float compute_fitness(Vec & out, const VecRef & y) {
     throw runtime_error("Not implemented");
   }
 
+  float set_fitness(Node * n, Vec & out, const VecRef & y) {
+    float fitness;
+    if (out.size() > y.size()) {
+      // drop the outputs of the padding rows of X (see dataset.hpp)
+      Vec real_out = out.head(y.size());
+      fitness = compute_fitness(real_out, y);
+    } else {
+      fitness = compute_fitness(out, y);
+    }
+    n->fitness = roundd(fitness, NUM_PRECISION + 2);
+    return fitness;
+  }
+
+  float get_fitness(Node * n, const MatRef & X, const VecRef & y) {
+    Vec out;
+    if (!jit::preferred() || !jit::compiled_output(n, X, out))
+      out = spec::get_output(n, X);
+    return set_fitness(n, out, y);
+  }
+
   // shorthand for training set
   float get_fitness(Node * n, Mat * X=NULL, Vec * y=NULL) {
+    prof::ScopedTimer timer(prof::phEvaluation);
+    trace::Scope trace_scope("evaluation", "evaluation", trace::sampled(trace::smEvaluation));
     if (!X)
       X = & this->X_batch;
     if (!y)
       y = & this->y_batch;
+    dataset::PackedScope packed_scope(X == &X_batch ? batch_precision : dataset::dpFloat32);
 
     // update evaluations
     evaluations += 1;
     node_evaluations += n->get_num_nodes(true); 
 
+    if (_offload(X, y))
+      return evalpool::evaluate(n);
+    _localize(X, y);
+
     // call specific implementation
     return get_fitness(n, *X, *y);
   }
 
-  Vec get_fitnesses(vector<Node*> population, bool compute=true, Mat * X=NULL, Vec * y=NULL) {  
+  // Whether to evaluate on the worker processes (see evaluation_pool.hpp), which then get the current batch
+  bool _offload(Mat * X, Vec * y) {
+    if (evalpool::num_workers <= 0 || X != &X_batch || y != &y_batch)
+      return false;
+    evalpool::sync(this, X_batch, y_batch, batch_version, batch_precision, X_train.rows(), [this](Node * n, const MatRef & X, const VecRef & y) {
+      return get_fitness(n, X, y);
+    });
+    return true;
+  }
+
+  // Points X & y to their copies on the NUMA node of the calling thread, if replicated (see numa.hpp)
+  void _localize(Mat *& X, Vec *& y) {
+    if (!numa::enabled)
+      return;
+    numa::Replicas::Copy * c = NULL;
+    if (X == &X_batch && y == &y_batch)
+      c = batch_replicas.local(X_batch, y_batch, batch_version);
+    else if (X == &X_train && y == &y_train)
+      c = train_replicas.local(X_train, y_train, train_version);
+    if (c) {
+      X = &c->X;
+      y = &c->y;
+    }
+  }
+
+  Vec get_fitnesses(vector<Node*> & population, bool compute=true, Mat * X=NULL, Vec * y=NULL) {  
     Vec fitnesses(population.size());
-    for(int i = 0; i < population.size(); i++) {
-      if (compute)
-        fitnesses[i] = get_fitness(population[i], X, y);
-      else
+    if (!compute) {
+      for(int i = 0; i < population.size(); i++)
         fitnesses[i] = population[i]->fitness;
+      return fitnesses;
+    }
+
+    prof::ScopedTimer timer(prof::phEvaluation);
+    trace::Scope trace_scope("evaluate_population", "evaluation");
+    trace_scope.arg("trees", population.size());
+    if (!X)
+      X = & this->X_batch;
+    if (!y)
+      y = & this->y_batch;
+    dataset::PackedScope packed_scope(X == &X_batch ? batch_precision : dataset::dpFloat32);
+
+    if (_offload(X, y)) {
+      for(Node * n : population) {
+        evaluations += 1;
+        node_evaluations += n->get_num_nodes(true);
+      }
+      return evalpool::evaluate(population);
+    }
+    _localize(X, y);
+
+    if (subtree_sharing_batch > 1 && !jit::preferred()) {
+      // compute identical subtrees only once (see batch_evaluation.hpp)
+      for(int i = 0; i < population.size(); i += subtree_sharing_batch) {
+        int end = min(i + subtree_sharing_batch, (int) population.size());
+        SubtreeDAG dag;
+        for(int j = i; j < end; j++)
+          dag.add_tree(population[j], j);
+        dag.evaluate(*X, [&](int j, Vec & out) {
+          evaluations += 1;
+          node_evaluations += population[j]->get_num_nodes(true);
+          fitnesses[j] = set_fitness(population[j], out, *y);
+        });
+      }
+      return fitnesses;
     }
+
+    for(int i = 0; i < population.size(); i++)
+      fitnesses[i] = get_fitness(population[i], X, y);
     return fitnesses;
   }
 
   void _set_X(Mat & X, string type="train") {
-    if (type == "train")
+    if (type == "train") {
       X_train = X;
+      train_version++;
+    }
     else if (type=="val")
       X_val = X;
     else
@@ -67,8 +176,10 @@ struct Fitness {
   }
 
   void _set_y(Vec & y, string type="train") {
-    if (type == "train")
+    if (type == "train") {
       y_train = y;
+      train_version++;
+    }
     else if (type=="val")
       y_val = y;
     else
@@ -84,10 +195,15 @@ struct Fitness {
   bool update_batch(int num_observations) {
 
     int n = X_train.rows();
+    batch_version++;
+
+    batch_precision = dataset::precision;
 
     if (num_observations==n) {
-      X_batch = X_train;
+      X_batch = dataset::pad ? dataset::padded(X_train) : X_train;
       y_batch = y_train;
+      batch_rows.resize(0);
+      _pack_batch();
       return false;
     }
     
@@ -95,9 +211,25 @@ struct Fitness {
     auto chosen = Rng::rand_perm(num_observations);
     this->X_batch = X_train(chosen, Eigen::all);
     this->y_batch = y_train(chosen);
+    if (dataset::pad)
+      this->X_batch = dataset::padded(X_batch);
+    batch_rows = Eigen::Map<Veci>(chosen.data(), chosen.size());
+    _pack_batch();
     return true;
   }
 
+  void _pack_batch() {
+    if (batch_precision != dataset::dpFloat32)
+      X_batch = dataset::packed(X_batch, batch_precision);
+  }
+
+  // The batch in float32 (unpadded), e.g., to compute final fitnesses when the search used 16-bit data
+  Mat batch_float32() {
+    if (batch_rows.size() == 0)
+      return X_train;
+    return X_train(batch_rows, Eigen::all);
+  }
+
 };
 
 struct MAEFitness : Fitness {
@@ -110,14 +242,10 @@ struct MAEFitness : Fitness {
     return new MAEFitness();
   }
 
-  float get_fitness(Node * n, Mat & X, Vec & y) override {
-    Vec out = n->get_output(X);
-
+  float compute_fitness(Vec & out, const VecRef & y) override {
     float fitness = (y - out).abs().mean();
     if (isnan(fitness) || fitness < 0) // the latter can happen due to float overflow
       fitness = INF;
-    n->fitness = roundd(fitness, NUM_PRECISION + 2);
-
     return fitness;
   }
 
@@ -133,14 +261,10 @@ struct MSEFitness : Fitness {
     return new MSEFitness();
   }
 
-  float get_fitness(Node * n, Mat & X, Vec & y) override {
-    Vec out = n->get_output(X);
-
+  float compute_fitness(Vec & out, const VecRef & y) override {
     float fitness = (y-out).square().mean();
     if (isnan(fitness) || fitness < 0) // the latter can happen due to float overflow
       fitness = INF;
-    n->fitness = roundd(fitness, NUM_PRECISION + 2);
-
     return fitness;
   }
 
@@ -156,16 +280,12 @@ struct AbsCorrFitness : Fitness {
     return new AbsCorrFitness();
   }
 
-  float get_fitness(Node * n, Mat & X, Vec & y) override {
-    Vec out = n->get_output(X);
-
+  float compute_fitness(Vec & out, const VecRef & y) override {
     float fitness = 1.0-abs(corr(y, out));
     // Below, the < 0 can happen due to float overflow, while 
     // the ==1 is meant to penalize constants as much as broken solutions
     if (isnan(fitness) || fitness < 0 || fitness == 1) 
       fitness = INF;
-    n->fitness = roundd(fitness, NUM_PRECISION + 2);
-
     return fitness;
   }
 
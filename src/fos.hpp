@@ -9,6 +9,7 @@
 #include "myeig.hpp"
 #include "util.hpp"
 #include "rng.hpp"
+#include "profiling.hpp"
 
 using namespace std;
 using namespace myeig;
@@ -21,7 +22,12 @@ struct FOSBuilder
 
   vector<vector<int>> build_linkage_tree(vector<Node *> &population)
   {
+    prof::ScopedTimer timer(prof::phLinkage);
+    trace::Scope trace_scope("linkage", "linkage");
     int num_random_variables = population[0]->subtree().size();
+    // MI matrix & discretized population, alive while the FOS is built
+    mem::Scoped linkage_memory(mem::msLinkage, (long long) num_random_variables * num_random_variables * sizeof(float)
+      + (long long) population.size() * (num_random_variables * sizeof(int) + sizeof(vector<int>) + mem::ALLOC_OVERHEAD));
 
     Mat MI;
 
@@ -43,10 +49,15 @@ struct FOSBuilder
       auto discr_pop = discrpop_n_numsymb.first;
       int num_symbs = discrpop_n_numsymb.second;
       // estimate MI
+      prof::ScopedTimer mi_timer(prof::phMI);
       MI = compute_MI(discr_pop, num_symbs, num_random_variables);
     }
 
-    vector<vector<int>> fos = fast_upgma(MI);
+    vector<vector<int>> fos;
+    {
+      prof::ScopedTimer upgma_timer(prof::phUPGMA);
+      fos = fast_upgma(MI);
+    }
     // remove the root to avoid complete replacements
     fos.pop_back();
 
@@ -177,17 +188,20 @@ struct FOSBuilder
   Mat compute_MI(vector<vector<int>> &discr_pop, int num_symbs, int num_random_variables)
   {
     int pop_size = discr_pop.size();
+    prof::count_mi_pairs((long long) num_random_variables * (num_random_variables + 1) / 2);
 
     // intiialize MI matrix at zero
     Mat MI = Mat::Zero(num_random_variables, num_random_variables);
 
-    // build pairwise frequency matrix for symbol pairs
-    Mat F = Mat::Zero(num_symbs, num_symbs);
-    int val_i, val_j;
-
-    // measure frequencies of pairs & compute single and joint entropy on the way
-    for (int i = 0; i < num_random_variables; i++)
+    // measure frequencies of pairs & compute single and joint entropy on the way;
+    // row i (MI(i, j) & MI(j, i) for j >= i) is a task of the scheduler, rows get shorter with i
+    parallel_for(num_random_variables, g::num_threads, [&](int i)
     {
+      prof::ScopedCounters hw_counters(prof::phMI); // (the timer of the phase counts the calling thread only)
+      // pairwise frequency matrix for symbol pairs
+      Mat F = Mat::Zero(num_symbs, num_symbs);
+      int val_i, val_j;
+
       for (int j = i + 1; j < num_random_variables; j++)
       {
         for (int p = 0; p < pop_size; p++)
@@ -234,7 +248,7 @@ struct FOSBuilder
           }
         }
       }
-    }
+    });
 
     // register bias to account for non-uniform distribution of symbols in initialized GP population
     if (first_time)
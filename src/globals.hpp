@@ -5,12 +5,17 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <functional>
 #include "myeig.hpp"
 #include "operator.hpp"
 #include "fitness.hpp"
 #include "cmdparser.hpp"
 #include "feature_selection.hpp"
 #include "rng.hpp"
+#include "profiling.hpp"
+#include "tracing.hpp"
+#include "memory.hpp"
+#include "islands.hpp"
 
 using namespace std;
 using namespace myeig;
@@ -18,7 +23,7 @@ using namespace myeig;
 namespace g {
 
   // ALL operators
-  vector<Op*> all_operators = {
+  inline vector<Op*> all_operators = {
     new Add(), new Sub(), new Neg(), new Mul(), new Div(), new Inv(), 
     new Square(), new Sqrt(), new Cube(),
     new Sin(), new Cos(), 
@@ -26,58 +31,66 @@ namespace g {
   };
 
   // ALL fitness functions 
-  vector<Fitness*> all_fitness_functions = {
+  inline vector<Fitness*> all_fitness_functions = {
     new MAEFitness(), new MSEFitness(), new AbsCorrFitness()
   };
 
   // budget
-  int pop_size;
-  int max_generations;
-  int max_time;
-  int max_evaluations;
-  long long max_node_evaluations;
-  bool disable_ims = false;
+  inline int pop_size;
+  inline int max_generations;
+  inline int max_time;
+  inline int max_evaluations;
+  inline long long max_node_evaluations;
+  inline bool disable_ims = false;
 
   // representation
-  int max_depth;
-  string init_strategy;
-  vector<Op*> functions;
-  vector<Op*> terminals;
-  Vec cumul_fset_probs;
-  Vec cumul_tset_probs;
-  string lib_tset; // used when `fit` is called when using as lib
-  string lib_tset_probs; // used when `fit` is called when using as lib
-  string complexity_type;
-  float rel_compl_importance=0.0;
-  int lib_feat_sel_number = -1; // used when `fit` is called when using as lib
+  inline int max_depth;
+  inline string init_strategy;
+  inline vector<Op*> functions;
+  inline vector<Op*> terminals;
+  inline Vec cumul_fset_probs;
+  inline Vec cumul_tset_probs;
+  inline string lib_tset; // used when `fit` is called when using as lib
+  inline string lib_tset_probs; // used when `fit` is called when using as lib
+  inline string complexity_type;
+  inline float rel_compl_importance=0.0;
+  inline int lib_feat_sel_number = -1; // used when `fit` is called when using as lib
 
   // problem
-  Fitness * fit_func = NULL;
-  string path_to_training_set;
-  string lib_batch_size; // used when `fit` is called when using as lib
-  int batch_size;
+  inline Fitness * fit_func = NULL;
+  inline string path_to_training_set;
+  inline string lib_batch_size; // used when `fit` is called when using as lib
+  inline int batch_size;
 
   // variation
-  int max_init_attempts = 10000;
-  bool no_linkage;
-  float cmut_eps;
-  float cmut_prob;
-  float cmut_temp;
-  bool no_large_subsets=false;
-  bool no_univariate=false;
-  bool no_univariate_except_leaves=false;
+  inline int max_init_attempts = 10000;
+  inline bool no_linkage;
+  inline float cmut_eps;
+  inline float cmut_prob;
+  inline float cmut_temp;
+  inline bool no_large_subsets=false;
+  inline bool no_univariate=false;
+  inline bool no_univariate_except_leaves=false;
+  inline int gom_window = 1;
 
   // selection
-  int tournament_size;
-  bool tournament_stochastic = false;
+  inline int tournament_size;
+  inline bool tournament_stochastic = false;
 
   // other
-  int random_state = -1;
-  bool verbose = true;
-  bool _call_as_lib = false;
+  inline int num_threads = 1;
+  inline int random_state = -1;
+  inline bool _call_as_lib = false;
+  // checked before every generation, the search stops when it returns true (set by the embedding layer, e.g., for CTRL+C in Python)
+  inline function<bool()> interrupt_check;
+  // time-to-target benchmark (see benchmark.hpp)
+  inline string ttt_datasets;
+  inline string ttt_targets;
+  inline int ttt_seeds;
+  inline string ttt_out;
 
   // Functions
-  void set_fit_func(string fit_func_name) { 
+  inline void set_fit_func(string fit_func_name) { 
     bool found = false;
     for (auto * f : all_fitness_functions) {
       if (f->name() == fit_func_name) {
@@ -90,7 +103,7 @@ namespace g {
     }
   }
 
-  void set_functions(string setting) {
+  inline void set_functions(string setting) {
     assert(functions.empty());
     vector<string> desired_operator_symbs = split_string(setting);
     for (string sym : desired_operator_symbs) {
@@ -106,9 +119,10 @@ namespace g {
         throw runtime_error("Unrecognized function: "+sym);
       }
     }
+    spec::select(functions);
   }
 
-  Vec _compute_custom_cumul_probs_operator_set(string setting, vector<Op*> & op_set) {
+  inline Vec _compute_custom_cumul_probs_operator_set(string setting, vector<Op*> & op_set) {
 
     auto str_v = split_string(setting);
     if (str_v.size() != op_set.size()) {
@@ -129,7 +143,7 @@ namespace g {
     return result;
   }
 
-  void set_function_probabilities(string setting) {
+  inline void set_function_probabilities(string setting) {
       
     if (setting == "auto") {
       // set unary operators to have half the chance other ones (which are normally binary)
@@ -163,7 +177,7 @@ namespace g {
     cumul_fset_probs = _compute_custom_cumul_probs_operator_set(setting, functions);
   }
 
-  void set_terminals(string setting) {
+  inline void set_terminals(string setting) {
     assert(terminals.empty());
 
     if (setting == "auto") {
@@ -195,7 +209,7 @@ namespace g {
     }
   }
 
-  void set_terminal_probabilities(string setting) {
+  inline void set_terminal_probabilities(string setting) {
     if (setting == "auto") {
       cumul_tset_probs = Vec(terminals.size());
       float p = 1.0 / terminals.size();
@@ -210,7 +224,7 @@ namespace g {
     cumul_tset_probs = _compute_custom_cumul_probs_operator_set(setting, terminals);
   }
 
-  string str_terminal_set() {
+  inline string str_terminal_set() {
     string str = "";
     for (Op * el : terminals) {
       if (el->type() == OpType::otConst && isnan(((Const*)el)->c)) {
@@ -223,7 +237,7 @@ namespace g {
     return str;
   }
 
-  void set_batch_size(string lib_batch_size) {
+  inline void set_batch_size(string lib_batch_size) {
     if (lib_batch_size == "auto") {
       batch_size = fit_func->X_train.rows();
     } else {
@@ -236,7 +250,7 @@ namespace g {
     }
   }
 
-  void apply_feature_selection(int num_feats_to_keep) {
+  inline void apply_feature_selection(int num_feats_to_keep) {
     // check if nothing needs to be done
     if (num_feats_to_keep == -1) {
       return;
@@ -250,7 +264,7 @@ namespace g {
       return;
 
     // proceed with feature selection
-    Veci indices_to_keep = feature_selection(fit_func->X_train, fit_func->y_train, num_feats_to_keep);
+    Veci indices_to_keep = feature_selection(fit_func->X_train, fit_func->y_train, num_feats_to_keep, num_threads);
     vector<int> indices_to_remove; indices_to_remove.reserve(terminals.size());
     for(int i = 0; i < terminals.size(); i++) {
       Op * o = terminals[i];
@@ -288,7 +302,7 @@ namespace g {
   }
   
 
-  void reset() {
+  inline void reset() {
     for(auto * f : functions) {
       delete f;
     }
@@ -302,7 +316,7 @@ namespace g {
     fit_func = NULL;
   }
 
-  void read_options(int argc, char** argv) {
+  inline void read_options(int argc, char** argv) {
     reset();
     cli::Parser parser(argc, argv);
 
@@ -313,6 +327,7 @@ namespace g {
     parser.set_optional<int>("e", "evaluations", -1, "Budget of evaluations (-1 for disabled)");
     parser.set_optional<long>("ne", "node_evaluations", -1, "Budget of node evaluations (-1 for disabled)");
     parser.set_optional<bool>("disable_ims", "disable_ims", false, "Whether to disable the IMS (default is false)");
+    parser.set_optional<int>("max_memory", "max_memory", 0, "Memory budget in MB: the IMS does not start evolutions that would not fit (0 for no budget, in which case the pop. size is capped at 2^20)");
     // initialization
     parser.set_optional<string>("is", "initialization_strategy", "hh", "Strategy to sample the initial population");
     parser.set_optional<int>("d", "depth", 4, "Maximum depth that the trees can have");
@@ -327,36 +342,117 @@ namespace g {
     parser.set_optional<string>("compl", "complexity_type", "node_count", "Measure to score the complexity of candidate sotluions (default is node_count)");
     parser.set_optional<float>("rci", "rel_compl_imp", 0.0, "Relative importance of complexity over accuracy to select the final elite (default is 0.0)");
     parser.set_optional<int>("feat_sel", "feature_selection", 10, "Max. number of feature to consider (if -1, all features are considered)");
+    parser.set_optional<int>("ss_batch", "subtree_sharing_batch", 256, "Number of trees among which identical subtrees are computed only once when evaluating a population (1 disables it)");
     // variation
     parser.set_optional<float>("cmp", "coefficient_mutation_probability", 0.1, "Probability of applying coefficient mutation to a coefficient node");
     parser.set_optional<float>("cmt", "coefficient_mutation_temperature", 0.05, "Temperature of coefficient mutation");
     parser.set_optional<int>("tour", "tournament_size", 2, "Tournament size (if tournament selection is active)");
+    parser.set_optional<int>("gom_window", "gom_window", 1, "Number of individuals whose GOM is in progress at once, with their evaluations batched; only useful with -eval_workers, whose requests it keeps in flight (1 for one at a time, the default)");
     parser.set_optional<bool>("nolink", "no_linkage", false, "Disables computing linkage when building the linkage tree FOS, essentially making it random");
     parser.set_optional<bool>("no_large_fos", "no_large_fos", false, "Whether to discard subsets in the FOS with size > half the size of the genotype (default is false)");
     parser.set_optional<bool>("no_univ_fos", "no_univ_fos", false, "Whether to discard univariate subsets in the FOS (default is false)");
     parser.set_optional<bool>("no_univ_exc_leaves_fos", "no_univ_exc_leaves_fos", false, "Whether to discard univariate subsets except for those that refer to leaves in the FOS (default is false)");
     // other
+    parser.set_optional<int>("threads", "num_threads", 1, "Number of threads (-1 for all available)");
+    parser.set_optional<bool>("pad_data", "pad_data", false, "Whether to pad the rows of the batch to a multiple of 16 (with no effect on the fitness), for vector kernels without scalar tails & cache-line aligned columns; large batches are also advised to use huge pages (default is false)");
+    parser.set_optional<string>("data_precision", "data_precision", "float32", "Precision the batch is stored with: float32, bfloat16, or float16 (16-bit data is widened to float32 on load; final fitnesses are computed in float32)");
+    parser.set_optional<bool>("numa", "numa", false, "Whether to pin the threads to NUMA nodes and to replicate the data evaluations read on each node (default is false)");
+    parser.set_optional<bool>("jit", "jit", false, "Whether to compile the trees that are evaluated repeatedly (elites, final linear scaling, batch predictions) to native code with the local C compiler (default is false)");
+    parser.set_optional<int>("jit_after", "jit_after", 20, "With -jit, number of evaluations of a tree during the search after which it is compiled, in the background (it is interpreted until then)");
+    parser.set_optional<string>("jit_cc", "jit_compiler", "", "C compiler for -jit (default: $CC, else cc, gcc, or clang)");
+    parser.set_optional<int>("eval_workers", "eval_workers", 0, "Number of worker processes the evaluations are offloaded to (0 to evaluate in-process)");
     parser.set_optional<int>("random_state", "random_state", -1, "Random state (seed)");
+    parser.set_optional<int>("islands", "islands", 1, "Number of island processes that exchange elites through shared memory (1 disables it; launch one process per island)");
+    parser.set_optional<int>("island_id", "island_id", 0, "Index of this island, in [0, islands)");
+    parser.set_optional<string>("island_shm", "island_shm", "/gpg_islands", "Name of the POSIX shared-memory segment of the islands");
+    parser.set_optional<int>("migration_interval", "migration_interval", 5, "Macro generations between migrations among islands");
+    parser.set_optional<int>("migrants", "migrants", 2, "Number of elites sent to the next island at each migration");
+    parser.set_optional<string>("ttt", "time_to_target", "", "Runs the time-to-target benchmark on these comma-separated data sets (CSV paths, or feynman_<eq>[:<rows>]) instead of a single run");
+    parser.set_optional<string>("ttt_targets", "time_to_target_targets", "0.5,0.2,0.1,0.05,0.01", "Fitness targets of the benchmark, relative to the fitness of the mean predictor (1.0 for ac)");
+    parser.set_optional<int>("ttt_seeds", "time_to_target_seeds", 5, "Number of seeds (runs) per data set of the benchmark, starting from -random_state (1 if not set)");
+    parser.set_optional<string>("ttt_out", "time_to_target_out", "", "Path where to write the records of the benchmark (JSON lines)");
+    parser.set_optional<bool>("profile", "profile", false, "Whether to collect per-phase timers & counters per evolution and macro generation");
+    parser.set_optional<string>("profile_out", "profile_out", "", "Path where to write the profiling records (CSV if it ends with .csv, else JSON lines; implies -profile)");
+    parser.set_optional<bool>("profile_hw", "profile_hw", false, "Whether to also collect hardware performance counters per phase (Linux perf events; implies -profile)");
+    parser.set_optional<string>("trace", "trace", "", "Path where to write a timeline of the search in the Chrome Trace Event format (e.g., to open in Perfetto)");
+    parser.set_optional<int>("trace_sample", "trace_sample", 0, "When tracing, trace one every this many GOM calls & evaluations (0 for none)");
     parser.set_optional<bool>("verbose", "verbose", false, "Verbose");
     parser.set_optional<bool>("lib", "call_as_lib", false, "Whether the code is called as a library (e.g., from Python)");
 
-    // set options
-    parser.run_and_exit_if_error();
+    // set options (when called as a library, invalid options must not terminate the host process)
+    bool as_lib = false;
+    for (int i = 1; i < argc; i++)
+      as_lib = as_lib || string(argv[i]) == "-lib";
+    if (as_lib) {
+      if (!parser.run())
+        throw runtime_error("Invalid options, see the message above");
+    } else {
+      parser.run_and_exit_if_error();
+    }
 
-    // verbose (MUST BE FIRST)
+    // verbose (MUST BE FIRST, print is silent unless set; cout itself is left alone, it may belong to a host program)
     verbose = parser.get<bool>("verbose");
-    if (!verbose) {
-      cout.rdbuf(NULL);
+
+    // threads
+    num_threads = parser.get<int>("threads");
+    if (num_threads < 1)
+      num_threads = max(1, (int) thread::hardware_concurrency());
+    print("num. threads: ", num_threads);
+    dataset::pad = parser.get<bool>("pad_data");
+    if (dataset::pad)
+      print("data: rows padded to a multiple of ", dataset::SIMD_FLOATS);
+    dataset::precision = dataset::parse_precision(parser.get<string>("data_precision"));
+    if (dataset::precision != dataset::dpFloat32)
+      print("data precision: ", dataset::precision_names[dataset::precision]);
+    numa::configure(parser.get<bool>("numa"));
+    if (numa::enabled)
+      print("NUMA nodes: ", numa::num_nodes(), " (threads pinned, data replicated per node)");
+    if (!jit::configure(parser.get<bool>("jit"), parser.get<string>("jit_cc"), parser.get<int>("jit_after")))
+      print("JIT: no C compiler found, trees are interpreted");
+    else if (jit::enabled)
+      print("JIT: compiling with ", jit::cache().compiler);
+    evalpool::stop();
+    evalpool::num_workers = parser.get<int>("eval_workers");
+    if (evalpool::num_workers > 0)
+      print("evaluation workers: ", evalpool::num_workers);
+
+    // profiling
+    string profile_out = parser.get<string>("profile_out");
+    hw::enabled = parser.get<bool>("profile_hw");
+    if (parser.get<bool>("profile") || !profile_out.empty() || hw::enabled) {
+      prof::enable(profile_out);
+      print("profiling: on", (profile_out.empty() ? "" : " (output: " + profile_out + ")"));
+    } else {
+      prof::disable();
+    }
+
+    // tracing
+    string trace_out = parser.get<string>("trace");
+    if (!trace_out.empty()) {
+      trace::enable(trace_out, parser.get<int>("trace_sample"));
+      print("tracing: on (output: ", trace_out, ")");
+    } else {
+      trace::disable();
     }
 
     // random_state
     random_state = parser.get<int>("random_state");
     if (random_state >= 0){
       Rng::set_seed(random_state);
+      Rng::set_stream(0); // (re-)seeds the rng of this thread
       print("random state: ", random_state);
     } else {
       print("random state: not set");
     }
+
+    // islands
+    island::num_islands = parser.get<int>("islands");
+    island::island_id = parser.get<int>("island_id");
+    island::shm_name = parser.get<string>("island_shm");
+    island::migration_interval = max(1, parser.get<int>("migration_interval"));
+    island::num_migrants = parser.get<int>("migrants");
+    if (island::active())
+      print("island ", island::island_id, " of ", island::num_islands, " (shared memory: ", island::shm_name, ", migration every ", island::migration_interval, " macro generations)");
     
     // budget
     disable_ims = parser.get<bool>("disable_ims");
@@ -378,6 +474,9 @@ namespace g {
       max_evaluations > -1 ? max_evaluations : INF, " evaluations, ", 
       max_node_evaluations > -1 ? max_node_evaluations : INF, " node evaluations" 
     );
+    mem::max_bytes = parser.get<int>("max_memory") * 1024LL * 1024LL;
+    if (mem::max_bytes > 0)
+      print("memory budget: ", mem::mb(mem::max_bytes));
 
     // initialization
     init_strategy = parser.get<string>("is");
@@ -391,6 +490,9 @@ namespace g {
     print("coefficient mutation probability: ", cmut_prob, ", temperature: ",cmut_temp);
     tournament_size = parser.get<int>("tour");
     print("tournament size: ", tournament_size);
+    gom_window = max(1, parser.get<int>("gom_window"));
+    if (gom_window > 1)
+      print("GOM window: ", gom_window);
 
     no_linkage = parser.get<bool>("nolink");
     no_large_subsets = parser.get<bool>("no_large_fos");
@@ -402,9 +504,17 @@ namespace g {
     string fit_func_name = parser.get<string>("ff");
     set_fit_func(fit_func_name);
     print("fitness function: ", fit_func_name);
+    fit_func->subtree_sharing_batch = parser.get<int>("ss_batch");
+    print("subtree sharing batch: ", fit_func->subtree_sharing_batch);
 
     _call_as_lib = parser.get<bool>("lib");
-    if (!_call_as_lib) {
+    ttt_datasets = parser.get<string>("ttt");
+    ttt_targets = parser.get<string>("ttt_targets");
+    ttt_seeds = parser.get<int>("ttt_seeds");
+    ttt_out = parser.get<string>("ttt_out");
+    // the data is set later when called as a library or when benchmarking
+    bool data_given_later = _call_as_lib || !ttt_datasets.empty();
+    if (!data_given_later) {
       // then it expects a training set
       path_to_training_set = parser.get<string>("train");
       // load up
@@ -417,7 +527,7 @@ namespace g {
       fit_func->set_Xy(X, y);
     } 
     lib_batch_size = parser.get<string>("bs");
-    if (!_call_as_lib) {
+    if (!data_given_later) {
       set_batch_size(lib_batch_size);
       print("batch size: ", g::batch_size);
     }
@@ -428,11 +538,12 @@ namespace g {
     string fset_p = parser.get<string>("fset_probs");
     set_function_probabilities(fset_p);
     print("function set: ",fset," (probabs: ",fset_p,")");
+    print("evaluator: ",spec::selected_name);
     
     lib_tset = parser.get<string>("tset");
     lib_feat_sel_number = parser.get<int>("feat_sel");
     lib_tset_probs = parser.get<string>("tset_probs");
-    if (!_call_as_lib) {
+    if (!data_given_later) {
       set_terminals(lib_tset);
       apply_feature_selection(lib_feat_sel_number);
       set_terminal_probabilities(lib_tset_probs);
@@ -446,10 +557,13 @@ namespace g {
 
     
     // other
-    cout << std::setprecision(NUM_PRECISION);
+    if (!as_lib)
+      cout << std::setprecision(NUM_PRECISION);
   }
 
-  void clear_globals() {
+  inline void clear_globals() {
+    evalpool::stop();
+    jit::release();
     for(auto * o : all_operators) {
       delete o;
     }
@@ -0,0 +1,77 @@
+#ifndef GPG_C_API_H
+#define GPG_C_API_H
+
+/*
+  Stable C API of libgpg, to embed the search in-process (no Python needed).
+
+  Typical use:
+    gpg_context * ctx = gpg_create("-g 20 -pop 512 -fset +,-,*,/ -random_state 42");
+    gpg_set_data(ctx, X, y, n_rows, n_cols);         // X is row-major
+    gpg_run(ctx, 1.0);                               // full configured budget
+    for (int i = 0; i < gpg_num_elites(ctx); i++)
+      gpg_evaluate(ctx, i, X_new, n_new, n_cols, predictions);
+    gpg_set_data(ctx, X_upd, y_upd, n_upd, n_cols);  // same features, e.g., fresh data
+    gpg_run(ctx, 0.25);                              // resume for a quarter of the budget
+    gpg_destroy(ctx);
+
+  Functions returning `int` return 0 on success and -1 on failure, in which case
+  `gpg_last_error` describes what went wrong. The configuration of the search is
+  process-global, hence only one context can exist at any given time.
+*/
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+  #define GPG_API __declspec(dllexport)
+#else
+  #define GPG_API __attribute__((visibility("default")))
+#endif
+
+#define GPG_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gpg_context gpg_context;
+
+GPG_API int gpg_api_version(void);
+
+// Message of the last error that occurred in the calling thread
+GPG_API const char * gpg_last_error(void);
+
+// Creates a context with the given (CLI-style) options, NULL on failure
+GPG_API gpg_context * gpg_create(const char * options);
+GPG_API void gpg_destroy(gpg_context * ctx);
+
+// Copies the training data; X is row-major with n_rows x n_cols elements
+GPG_API int gpg_set_data(gpg_context * ctx, const float * X, const float * y, int n_rows, int n_cols);
+
+// Runs the search for `budget` times the configured budget. The first run starts from scratch,
+// the following ones resume from the previous state on the current data (which must keep the same features)
+GPG_API int gpg_run(gpg_context * ctx, double budget);
+
+// Discards the state of the search, so that the next run starts from scratch
+GPG_API int gpg_reset(gpg_context * ctx);
+
+// Asks a run in progress to stop at the next generation, can be called from any thread
+GPG_API void gpg_request_stop(gpg_context * ctx);
+
+// Elites of the last run, sorted by increasing complexity, -1 on failure
+GPG_API int gpg_num_elites(gpg_context * ctx);
+// Human-readable expression of an elite, valid until the next run, NULL on failure
+GPG_API const char * gpg_elite_repr(gpg_context * ctx, int elite_idx);
+GPG_API int gpg_elite_scores(gpg_context * ctx, int elite_idx, float * fitness, float * complexity);
+// Serialised program of an elite (see program.hpp), valid until the next run
+GPG_API int gpg_elite_program(gpg_context * ctx, int elite_idx, const char ** program, size_t * length);
+
+// Writes the output of an elite for each of the n_rows (row-major) rows of X into out
+GPG_API int gpg_evaluate(gpg_context * ctx, int elite_idx, const float * X, int n_rows, int n_cols, float * out);
+// Same, for a serialised program (no context needed)
+GPG_API int gpg_evaluate_program(const char * program, size_t length, const float * X, int n_rows, int n_cols, float * out, int num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
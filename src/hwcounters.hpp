@@ -0,0 +1,130 @@
+#ifndef HWCOUNTERS_H
+#define HWCOUNTERS_H
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+/*
+  Hardware performance counters (cycles, instructions, cache misses, branch misses) of the
+  calling thread, read with perf_event_open (Linux only). Each thread opens its own group of
+  counters the first time it reads them. User-space only is counted, which is permitted with the
+  default `kernel.perf_event_paranoid` setting. If the counters cannot be opened (e.g., not
+  permitted, no PMU in a virtual machine, not Linux), a warning is printed once and reads return
+  zeros, so that the rest of the profiling keeps working.
+*/
+
+namespace hw {
+
+  enum Counter {
+    hwCycles, hwInstructions, hwCacheMisses, hwBranchMisses, NUM_COUNTERS
+  };
+
+  inline const char * counter_names[NUM_COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+  };
+
+  struct Counts {
+    long long v[NUM_COUNTERS] = {};
+  };
+
+  inline bool enabled = false;
+  inline bool available = true; // false after the first failure to open the counters
+
+  inline void _unavailable(string reason) {
+    if (available)
+      cerr << "warning: hardware performance counters are not available (" << reason << "), they will be reported as 0" << endl;
+    available = false;
+  }
+
+#ifdef __linux__
+
+  struct ThreadCounters {
+    int fds[NUM_COUNTERS];
+    bool opened = false;
+
+    ThreadCounters() {
+      for (int c = 0; c < NUM_COUNTERS; c++)
+        fds[c] = -1;
+      if (!available)
+        return;
+      unsigned long long configs[NUM_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+      };
+      for (int c = 0; c < NUM_COUNTERS; c++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[c];
+        attr.disabled = c == 0; // the group starts with its leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // this thread, any cpu
+        fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, c == 0 ? -1 : fds[0], 0);
+        if (fds[c] < 0) {
+          _unavailable(string("perf_event_open: ") + strerror(errno));
+          close_all();
+          return;
+        }
+      }
+      ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      opened = true;
+    }
+
+    void close_all() {
+      for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (fds[c] >= 0)
+          close(fds[c]);
+        fds[c] = -1;
+      }
+      opened = false;
+    }
+
+    ~ThreadCounters() {
+      close_all();
+    }
+  };
+
+  // Counts since the counters of this thread were opened
+  inline Counts read() {
+    Counts counts;
+    thread_local ThreadCounters tc;
+    if (!tc.opened)
+      return counts;
+    // layout of PERF_FORMAT_GROUP: number of counters, then their values
+    unsigned long long buf[1 + NUM_COUNTERS];
+    if (::read(tc.fds[0], buf, sizeof(buf)) != sizeof(buf)) {
+      _unavailable("failed read");
+      tc.close_all();
+      return counts;
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++)
+      counts.v[c] = buf[1 + c];
+    return counts;
+  }
+
+#else
+
+  inline Counts read() {
+    _unavailable("not supported on this platform");
+    return Counts();
+  }
+
+#endif
+
+}
+
+#endif
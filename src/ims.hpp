@@ -1,7 +1,6 @@
 #ifndef IMS_H
 #define IMS_H
 
-#include <Python.h>
 #include <unordered_map>
 
 #include "globals.hpp"
@@ -9,37 +8,51 @@
 #include "evolution.hpp"
 #include "myeig.hpp"
 #include "rng.hpp"
+#include "profiling.hpp"
+#include "program.hpp"
+#include "islands.hpp"
 
 using namespace std;
 using namespace myeig;
 
 struct IMS {
 
-  int MAX_POP_SIZE = (int) pow(2,20);
+  int MAX_POP_SIZE = (int) pow(2,20); // without a memory budget (-max_memory)
+  int MAX_POP_SIZE_BUDGETED = numeric_limits<int>::max(); // with a budget, which then decides
   int SUB_GENs = 4;
+  int refused_pop_size = -1; // last pop. size refused for not fitting the memory budget
 
   vector<Evolution*> evolutions;
   int macro_generations = 0;
+  bool warm_started = false; // the profiling records of the next run began with warm_start
   unordered_map<float, Node*> elites_per_complexity;
+  // elites as returned at the end of a run (e.g., incl. linear scaling), kept apart 
+  // from `elites_per_complexity` so that the search can be resumed
+  unordered_map<float, Node*> final_elites;
+  // optional, called at the end of every macro generation (e.g., to record anytime performance)
+  function<void(IMS&)> on_macro_generation;
 
   ~IMS() {
     for (Evolution * e : evolutions) {
       delete e;
     }
     reset_elites();
+    reset_final_elites();
   }
 
-  Node * select_elite(float rel_compl_importance=0.0) {
+  Node * select_elite(float rel_compl_importance=0.0, unordered_map<float, Node*> * elites=NULL) {
+    if (!elites)
+      elites = &elites_per_complexity;
     // get relative fitness among elites
     float min_fit = INF;
     float max_fit = NINF;
     float min_compl = INF;
     float max_compl = NINF;
-    vector<Node*> ordered_elites; ordered_elites.reserve(elites_per_complexity.size());
-    vector<float> ordered_fitnesses; ordered_fitnesses.reserve(elites_per_complexity.size());
-    vector<float> ordered_complexities; ordered_complexities.reserve(elites_per_complexity.size());
+    vector<Node*> ordered_elites; ordered_elites.reserve(elites->size());
+    vector<float> ordered_fitnesses; ordered_fitnesses.reserve(elites->size());
+    vector<float> ordered_complexities; ordered_complexities.reserve(elites->size());
 
-    for(auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); ++it) {
+    for(auto it = elites->begin(); it != elites->end(); ++it) {
 
       float f = it->second->fitness;
       float c = it->first;
@@ -76,23 +89,75 @@ struct IMS {
     return ordered_elites[best_idx];
   }
 
+  // (Re-)measures the long-lived structures for the memory accounting
+  void account_memory() {
+    if (!mem::measuring())
+      return;
+    long long populations = 0, linkage = 0, elites = 0;
+    for (Evolution * e : evolutions) {
+      populations += mem::trees_bytes(e->population);
+      linkage += mem::bytes_of(e->fb->B);
+    }
+    for (auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++)
+      elites += mem::tree_bytes(it->second);
+    for (auto it = final_elites.begin(); it != final_elites.end(); it++)
+      elites += mem::tree_bytes(it->second);
+    Fitness * f = g::fit_func;
+    long long dataset = mem::bytes_of(f->X_train) + mem::bytes_of(f->X_val) + mem::bytes_of(f->X_batch)
+      + mem::bytes_of(f->y_train) + mem::bytes_of(f->y_val) + mem::bytes_of(f->y_batch)
+      + f->batch_replicas.total_bytes() + f->train_replicas.total_bytes();
+    mem::set(mem::msPopulations, populations);
+    mem::set(mem::msLinkage, linkage);
+    mem::set(mem::msElites, elites);
+    mem::set(mem::msDataset, dataset);
+  }
+
+  // Estimate of the memory an evolution needs at its peak: parents & offspring, and linkage
+  long long evolution_bytes(int pop_size) {
+    int max_arity = 0;
+    for (Op * op : g::functions)
+      max_arity = max(max_arity, op->arity());
+    long long genotype_length = mem::template_num_nodes(g::max_depth, max_arity);
+    long long population = pop_size * (mem::template_tree_bytes(g::max_depth, max_arity) + (long long) sizeof(Node*));
+    long long linkage = 2 * genotype_length * genotype_length * sizeof(float) 
+      + pop_size * (genotype_length * sizeof(int) + sizeof(vector<int>) + mem::ALLOC_OVERHEAD);
+    return 2 * population + linkage;
+  }
+
   bool initialize_new_evolution() {
+    prof::ScopedTimer timer(prof::phInitEvolution);
+    trace::Scope trace_scope("init_evolution", "ims");
     // if it is the first evolution
-    int pop_size;
+    long long next_pop_size; // (doubling may not fit an int)
     if (evolutions.empty()) {
       evolutions.reserve(10);
-      pop_size = g::pop_size;
+      next_pop_size = g::pop_size;
     } else {
-      pop_size = evolutions[evolutions.size()-1]->population.size() * 2;
+      next_pop_size = evolutions[evolutions.size()-1]->population.size() * 2LL;
     }
     // skip if new pop.size is too large
-    if (pop_size > MAX_POP_SIZE) {
+    if (next_pop_size > (mem::max_bytes > 0 ? MAX_POP_SIZE_BUDGETED : MAX_POP_SIZE)) {
       return false;
     }
+    int pop_size = next_pop_size;
     // or skip if options set not to use IMS and we already have 1 evolution
     if (g::disable_ims && evolutions.size() > 0) {
       return false;
     }
+    // or skip if it would not fit the memory budget
+    if (mem::max_bytes > 0) {
+      long long needed = evolution_bytes(pop_size);
+      if (mem::current_total + needed > mem::max_bytes) {
+        if (evolutions.empty())
+          throw runtime_error("An evolution with pop.size " + to_string(pop_size) + " needs about " + mem::mb(needed) 
+            + ", more than the memory budget of " + mem::mb(mem::max_bytes));
+        if (refused_pop_size != pop_size)
+          print(" - not starting an evolution with pop.size ", pop_size, ": it needs about ", mem::mb(needed), 
+            " and ", mem::mb(mem::current_total), " of ", mem::mb(mem::max_bytes), " are in use");
+        refused_pop_size = pop_size;
+        return false;
+      }
+    }
     Evolution * evo = new Evolution(pop_size);
 
     if (g::disable_ims && elites_per_complexity.size() > 0) {
@@ -111,6 +176,7 @@ struct IMS {
     }
 
     evolutions.push_back(evo);
+    account_memory();
     print(" + init. new evolution with pop.size: ",pop_size);
     return true;
   }
@@ -124,6 +190,8 @@ struct IMS {
   }
 
   void terminate_obsolete_evolutions() {
+    prof::ScopedTimer timer(prof::phTerminateEvolutions);
+    trace::Scope trace_scope("terminate_evolutions", "ims");
     int largest_obsolete_idx = -1;
     for(int i = evolutions.size() - 1; i >= 0; i--) {
       auto fitnesses_i = g::fit_func->get_fitnesses(evolutions[i]->population, false);
@@ -168,17 +236,104 @@ struct IMS {
     elites_per_complexity.clear();
   }
 
+  void reset_final_elites() {
+    for(auto it = final_elites.begin(); it != final_elites.end(); it++) {
+      it->second->clear();
+    }
+    final_elites.clear();
+  }
+
+  void set_final_elites() {
+    reset_final_elites();
+    // if the search used 16-bit data (see dataset.hpp), the final fitnesses are computed in float32
+    bool recompute = g::fit_func->batch_precision != dataset::dpFloat32;
+    Mat X_float32 = recompute ? g::fit_func->batch_float32() : Mat();
+    jit::Scope jit_scope;
+    for (auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++) {
+      Node * elite = it->second->clone();
+      if (recompute)
+        g::fit_func->get_fitness(elite, X_float32, g::fit_func->y_batch);
+      // if abs corr, append linear scaling terms
+      if (g::fit_func->name() == "ac") {
+        elite = append_linear_scaling(elite);
+      }
+      final_elites[it->first] = elite;
+    }
+  }
+
   void reevaluate_elites() {
+    vector<Node*> elites; elites.reserve(elites_per_complexity.size());
+    for(auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++) {
+      elites.push_back(it->second);
+    }
+    // the elites are evaluated on every batch, worth compiling (see jit.hpp)
+    jit::Scope jit_scope;
+    g::fit_func->get_fitnesses(elites);
+  }
+
+  // Initializes the first evolution, profiled as macro generation 0
+  void initialize_first_evolution() {
+    auto init_start_time = prof::now();
+    auto init_start = prof::snapshot();
+    long long init_start_evals = g::fit_func->evaluations;
+    long long init_start_node_evals = g::fit_func->node_evaluations;
+    initialize_new_evolution();
+    if (prof::enabled && !evolutions.empty()) {
+      auto init_end = prof::snapshot();
+      prof::emit(0, 0, evolutions[0]->pop_size, prof::elapsed(init_start_time), 
+        g::fit_func->evaluations - init_start_evals, g::fit_func->node_evaluations - init_start_node_evals, 
+        init_start, init_end);
+    }
+  }
+
+  // To be called when the training set changed: updates the fitness of populations & elites, 
+  // re-filters the elites (dominance may have changed), and seeds the most recent population with them
+  void warm_start() {
+    // what is done here is part of the continued run
+    prof::records.clear();
+    warm_started = true;
+
+    for (Evolution * e : evolutions) {
+      g::fit_func->get_fitnesses(e->population);
+    }
+
+    vector<Node*> elites; elites.reserve(elites_per_complexity.size());
     for(auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++) {
-      float fit_before = it->second->fitness;
-      g::fit_func->get_fitness(it->second);
+      elites.push_back(it->second);
+    }
+    g::fit_func->get_fitnesses(elites);
+    elites_per_complexity.clear();
+    update_elites(elites);
+
+    if (evolutions.empty())
+      initialize_first_evolution();
+    // replace the worst solutions of the most recent population with the elites
+    vector<Node*> & population = evolutions[evolutions.size()-1]->population;
+    Vec fitnesses = g::fit_func->get_fitnesses(population, false);
+    Veci order = sort_order(fitnesses);
+    int num_seeds = min(elites.size(), population.size() / 2);
+    for(int i = 0; i < num_seeds; i++) {
+      int repl_idx = order[order.size() - 1 - i];
+      population[repl_idx]->clear();
+      population[repl_idx] = elites[i]; // ownership moves to the population
+    }
+    for(int i = num_seeds; i < elites.size(); i++) {
+      elites[i]->clear();
     }
   }
 
   void update_elites(vector<Node*>& population) {
-    for (Node * tree : population){
+    prof::ScopedTimer timer(prof::phUpdateElites);
+    trace::Scope trace_scope("update_elites", "ims");
+    // complexities (which can compute activity masks) in parallel, the archive is then updated serially
+    vector<float> complexities(population.size());
+    parallel_for(population.size(), g::num_threads, [&](int i) {
+      complexities[i] = compute_complexity(population[i]);
+    }, 64);
+    for (int i = 0; i < population.size(); i++){
+      Node * tree = population[i];
       // determine if to insert this among elites and eliminate now-obsolete elites
-      float c = compute_complexity(tree);
+      float c = complexities[i];
       // firstly, check if current tree is equal or worse than an existing elite
       bool worse_or_equal_than_existing = false;
       vector<float> obsolete_complexities; obsolete_complexities.reserve(elites_per_complexity.size());
@@ -211,30 +366,115 @@ struct IMS {
 
   }
 
+  // Sends the best elites to the next island and injects those received from the previous one (see islands.hpp)
+  void migrate() {
+    trace::Scope trace_scope("migration", "ims");
+    vector<Node*> best; best.reserve(elites_per_complexity.size());
+    for(auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++)
+      best.push_back(it->second);
+    sort(best.begin(), best.end(), [](Node * a, Node * b) { return a->fitness < b->fitness; });
+    vector<string> genotypes;
+    for(int i = 0; i < best.size() && genotypes.size() < island::num_migrants; i++) {
+      try {
+        genotypes.push_back(serialize_genotype(best[i]));
+      } catch (runtime_error & e) {
+        // operator without opcode, cannot migrate
+      }
+    }
+    island::publish(genotypes);
+
+    vector<string> received = island::receive();
+    if (received.empty() || evolutions.empty())
+      return;
+    vector<Node*> & population = evolutions[evolutions.size()-1]->population;
+    vector<Node*> template_nodes = population[0]->subtree();
+    unordered_set<string> function_syms;
+    for(Op * op : g::functions)
+      function_syms.insert(op->sym());
+    vector<Node*> migrants;
+    for(string & genotype : received) {
+      Node * migrant;
+      try {
+        migrant = deserialize_genotype(genotype);
+      } catch (runtime_error & e) {
+        continue;
+      }
+      // must share the template (same number of children at each position), and use features that 
+      // exist here and functions of the function set
+      vector<Node*> nodes = migrant->subtree();
+      bool compatible = nodes.size() == template_nodes.size();
+      for(int i = 0; i < nodes.size() && compatible; i++) {
+        Op * op = nodes[i]->op;
+        compatible = nodes[i]->children.size() == template_nodes[i]->children.size() 
+          && op->arity() <= nodes[i]->children.size();
+        if (op->type() == OpType::otFeat)
+          compatible = compatible && ((Feat*) op)->id >= 0 && ((Feat*) op)->id < g::fit_func->X_train.cols();
+        else if (op->type() == OpType::otFun)
+          compatible = compatible && function_syms.count(op->sym()) > 0;
+      }
+      if (!compatible) {
+        migrant->clear();
+        continue;
+      }
+      migrants.push_back(migrant);
+    }
+    if (migrants.empty())
+      return;
+
+    g::fit_func->get_fitnesses(migrants);
+    update_elites(migrants);
+    // inject them into the most recent population, replacing random solutions
+    for(Node * migrant : migrants) {
+      int repl_idx = Rng::randi(population.size());
+      population[repl_idx]->clear();
+      population[repl_idx] = migrant;
+    }
+    print(" + injected ", migrants.size(), " migrants from island ", (island::island_id + island::num_islands - 1) % island::num_islands);
+  }
+
   void run() {
 
     auto start_time = tick();
+    if (!warm_started)
+      prof::records.clear();
+    warm_started = false;
+    mem::reset();
+    account_memory();
 
-    // initialize the first evolution
-    initialize_new_evolution();
+    // initialize the first evolution (unless resuming)
+    if (evolutions.empty()) {
+      initialize_first_evolution();
+    }
     
     bool stop = false;
     while(!stop) {
 
       // macro generation
+      auto macro_gen_start_time = prof::now();
+      auto macro_gen_start = prof::snapshot();
+      long long macro_gen_start_evals = g::fit_func->evaluations;
+      long long macro_gen_start_node_evals = g::fit_func->node_evaluations;
+      trace::Scope macro_gen_trace("macro_generation", "ims");
+      macro_gen_trace.arg("macro_generation", macro_generations + 1);
 
       // update mini batch
-      bool mini_batch_changed = g::fit_func->update_batch(g::batch_size);
-      if (mini_batch_changed){
-        reevaluate_elites();
+      {
+        prof::ScopedTimer timer(prof::phBatchUpdate);
+        trace::Scope trace_scope("batch_update", "ims");
+        bool mini_batch_changed = g::fit_func->update_batch(g::batch_size);
+        if (mini_batch_changed){
+          reevaluate_elites();
+        }
       }
 
       int curr_num_evos = evolutions.size();
+      int num_generations = 0; // performed in this macro generation
       for (int i = 0; i < curr_num_evos + 1; i++) {
         
         // check should stop
-        if(g::_call_as_lib && PyErr_CheckSignals() == -1) {
-          exit(1);
+        if (g::interrupt_check && g::interrupt_check()) {
+          stop = true;
+          break;
         }
         if (
           (g::max_generations > 0 && macro_generations == g::max_generations) ||
@@ -257,6 +497,11 @@ struct IMS {
         if (!should_perform_gen)
           continue;
 
+        auto evo_start_time = prof::now();
+        auto evo_start = prof::snapshot();
+        long long evo_start_evals = g::fit_func->evaluations;
+        long long evo_start_node_evals = g::fit_func->node_evaluations;
+
         // must be initialized
         if (i == evolutions.size()) {
           bool possible = initialize_new_evolution();
@@ -266,37 +511,57 @@ struct IMS {
 
         // perform generation
         evolutions[i]->gomea_generation();
+        num_generations++;
 
         // update elites
         update_elites(evolutions[i]->population);
         //print("\tperformed evo with pop.size: ",evolutions[i]->pop_size);
+
+        if (prof::enabled) {
+          auto evo_end = prof::snapshot();
+          prof::emit(macro_generations + 1, i, evolutions[i]->pop_size, prof::elapsed(evo_start_time), 
+            g::fit_func->evaluations - evo_start_evals, g::fit_func->node_evaluations - evo_start_node_evals, 
+            evo_start, evo_end);
+        }
       }
 
       // decide if some evos should terminate
       terminate_obsolete_evolutions();
+      account_memory();
+
+      if (prof::enabled && num_generations > 0) {
+        auto macro_gen_end = prof::snapshot();
+        prof::emit(macro_generations + 1, -1, 0, prof::elapsed(macro_gen_start_time), 
+          g::fit_func->evaluations - macro_gen_start_evals, g::fit_func->node_evaluations - macro_gen_start_node_evals, 
+          macro_gen_start, macro_gen_end);
+      }
 
       // update macro gen
       macro_generations += 1;
       float curr_best_fit = select_elite(0.0)->fitness;
       print(" ~ macro generation: ", macro_generations, ", curr. best fit: ",curr_best_fit);
+      if (island::active() && macro_generations % island::migration_interval == 0)
+        migrate();
+      if (on_macro_generation)
+        on_macro_generation(*this);
     }
 
     // finished
-
-    // if abs corr, append linear scaling terms
-    if (g::fit_func->name() == "ac") {
-      for (auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++) {
-        elites_per_complexity[it->first] = append_linear_scaling(it->second);
-      }
-    }
+    island::detach();
+    set_final_elites();
+    trace::write();
+    account_memory();
+    print(mem::report());
+    if (numa::enabled)
+      print(numa::report());
 
     if (!g::_call_as_lib) { // TODO: remove false
       print("\nAll elites found:");
-      for (auto it = elites_per_complexity.begin(); it != elites_per_complexity.end(); it++) {
+      for (auto it = final_elites.begin(); it != final_elites.end(); it++) {
         print(it->first, " ", it->second->fitness, ":", it->second->human_repr());
       }
       print("\nBest w.r.t. complexity for chosen importance:");
-      print(this->select_elite(g::rel_compl_importance)->human_repr());
+      print(this->select_elite(g::rel_compl_importance, &final_elites)->human_repr());
     }
     
   }
@@ -0,0 +1,189 @@
+#ifndef ISLANDS_H
+#define ISLANDS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <cstdint>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+  Island model across processes (options `-islands`, `-island_id`, `-island_shm`).
+  Independent processes, e.g., one per socket (pinned with `numactl`), run their own search
+  and exchange elites every `-migration_interval` macro generations through a POSIX
+  shared-memory segment. The segment holds one mailbox per island, where the island publishes
+  its best elites as serialised genotypes (see program.hpp); each island reads the mailbox of
+  its predecessor on a ring. Mailboxes are seqlocks, so publishing never waits for readers and
+  a reader retries if it raced with a write. No memory is shared in the inner loop.
+  The first process to attach initializes the segment, the last one to detach removes it.
+  Islands should use different seeds, e.g.:
+    for i in 0 1; do numactl -N $i -m $i ./gpg -train data.csv -islands 2 -island_id $i -random_state $i & done
+*/
+
+namespace island {
+
+  const uint32_t SHM_MAGIC = 0x47504749; // "GPGI"
+  const int MAILBOX_BYTES = 1 << 16;
+
+  struct Mailbox {
+    atomic<uint64_t> seq; // odd while being written
+    uint32_t num_migrants;
+    uint32_t num_bytes;
+    char data[MAILBOX_BYTES]; // for each migrant: length (uint32) | genotype
+  };
+
+  struct Header {
+    atomic<int> state; // 0: uninitialized, 1: being initialized, 2: ready
+    uint32_t magic;
+    int num_islands;
+    atomic<int> attached;
+  };
+
+  static_assert(atomic<uint64_t>::is_always_lock_free && atomic<int>::is_always_lock_free,
+    "shared-memory mailboxes need address-free atomics");
+
+  inline int num_islands = 1; // 1: disabled
+  inline int island_id = 0;
+  inline string shm_name = "/gpg_islands";
+  inline int migration_interval = 5;
+  inline int num_migrants = 2;
+
+  inline Header * header = NULL;
+  inline size_t segment_bytes = 0;
+  inline uint64_t last_seen_seq = 0;
+
+  inline bool active() {
+    return num_islands > 1;
+  }
+
+  inline Mailbox * _mailbox(int i) {
+    return (Mailbox*) ((char*) header + sizeof(Header)) + i;
+  }
+
+  inline void attach() {
+    if (header || !active())
+      return;
+    if (island_id < 0 || island_id >= num_islands)
+      throw runtime_error("Invalid island id "+to_string(island_id)+" for "+to_string(num_islands)+" islands");
+    segment_bytes = sizeof(Header) + num_islands * sizeof(Mailbox);
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+      throw runtime_error("Cannot open the shared-memory segment "+shm_name+": "+strerror(errno));
+    struct stat st;
+    // ftruncate zero-fills, so that the state is 0 until initialized
+    if (fstat(fd, &st) != 0 || (st.st_size < segment_bytes && ftruncate(fd, segment_bytes) != 0)) {
+      close(fd);
+      throw runtime_error("Cannot size the shared-memory segment "+shm_name+": "+strerror(errno));
+    }
+    void * addr = mmap(NULL, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+      throw runtime_error("Cannot map the shared-memory segment "+shm_name+": "+strerror(errno));
+    header = (Header*) addr;
+
+    int expected = 0;
+    if (header->state.compare_exchange_strong(expected, 1)) {
+      header->magic = SHM_MAGIC;
+      header->num_islands = num_islands;
+      header->attached = 0;
+      for (int i = 0; i < num_islands; i++) {
+        _mailbox(i)->seq = 0;
+        _mailbox(i)->num_migrants = 0;
+        _mailbox(i)->num_bytes = 0;
+      }
+      header->state = 2;
+    } else {
+      while (header->state.load() != 2)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    if (header->magic != SHM_MAGIC || header->num_islands != num_islands) {
+      munmap(header, segment_bytes);
+      header = NULL;
+      throw runtime_error("The shared-memory segment "+shm_name+" belongs to a different set of islands");
+    }
+    header->attached++;
+    last_seen_seq = 0;
+  }
+
+  inline void detach() {
+    if (!header)
+      return;
+    bool last = --header->attached == 0;
+    munmap(header, segment_bytes);
+    header = NULL;
+    if (last)
+      shm_unlink(shm_name.c_str());
+  }
+
+  // Publishes the genotypes in the mailbox of this island (as many as fit)
+  inline void publish(vector<string> & genotypes) {
+    attach();
+    Mailbox * mb = _mailbox(island_id);
+    mb->seq.fetch_add(1, memory_order_acq_rel);
+    uint32_t num_bytes = 0, count = 0;
+    for (string & g : genotypes) {
+      uint32_t len = g.size();
+      if (num_bytes + sizeof(uint32_t) + len > MAILBOX_BYTES)
+        break;
+      memcpy(mb->data + num_bytes, &len, sizeof(uint32_t));
+      memcpy(mb->data + num_bytes + sizeof(uint32_t), g.data(), len);
+      num_bytes += sizeof(uint32_t) + len;
+      count++;
+    }
+    mb->num_migrants = count;
+    mb->num_bytes = num_bytes;
+    mb->seq.fetch_add(1, memory_order_release);
+  }
+
+  // Genotypes published by the predecessor on the ring since the last call (empty if none)
+  inline vector<string> receive() {
+    attach();
+    Mailbox * mb = _mailbox((island_id + num_islands - 1) % num_islands);
+    vector<char> data;
+    uint32_t count;
+    uint64_t seq;
+    while (true) {
+      seq = mb->seq.load(memory_order_acquire);
+      if (seq == last_seen_seq || seq % 2 == 1) {
+        if (seq % 2 == 1) { // being written, try again shortly
+          this_thread::yield();
+          continue;
+        }
+        return vector<string>();
+      }
+      count = mb->num_migrants;
+      uint32_t num_bytes = min<uint32_t>(mb->num_bytes, MAILBOX_BYTES);
+      data.assign(mb->data, mb->data + num_bytes);
+      atomic_thread_fence(memory_order_acquire);
+      if (mb->seq.load(memory_order_relaxed) == seq)
+        break;
+    }
+    last_seen_seq = seq;
+
+    vector<string> genotypes;
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count && pos + sizeof(uint32_t) <= data.size(); i++) {
+      uint32_t len;
+      memcpy(&len, data.data() + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+      if (pos + len > data.size())
+        break;
+      genotypes.push_back(string(data.data() + pos, len));
+      pos += len;
+    }
+    return genotypes;
+  }
+
+}
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "myeig.hpp"
+#include "node.hpp"
+#include "operator.hpp"
+#include "dataset.hpp"
+#include "util.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Native code for long-lived trees (option `-jit`).
+  The active part of a tree is emitted as a C function that computes the whole tree for one row
+  at a time (so that the compiler keeps the intermediate values in registers and vectorizes the
+  loop over the rows), which is compiled by the local C compiler (`-jit_cc`, else $CC, cc, gcc,
+  or clang) into a shared object and loaded with dlopen. Kernels are cached by their source,
+  which identifies the active genotype (features, constants, and operators), so a tree is
+  compiled once no matter how many times, or on how many batches, it is evaluated.
+  Compiling takes tens of milliseconds, so it only pays off for trees that are evaluated many
+  times: the elites, when they are re-evaluated on a new batch, the final linear scaling, and the
+  batch predictor (serving). During the search, a tree is compiled only once it was evaluated
+  `-jit_after` times, by a background thread, and it is interpreted until its kernel is ready, so
+  that the search never waits for the compiler; the batch predictor waits for the kernel.
+  The use counts of at most `max_counted` trees that are not compiled yet are kept (the least
+  recently used are forgotten), and `release` unloads all kernels (e.g., at the end of a session).
+  The kernels do what Node::get_output does: constant subtrees are folded by the interpreter at
+  emission time, and each function output is rounded the same way, so that outputs are
+  bit-identical, except for sin and cos (libm instead of Eigen's versions, which can differ in the
+  last bit). Without a compiler, or for packed (16-bit) data, trees are interpreted.
+*/
+
+namespace jit {
+
+  // Computes rows outputs into out; column j of X starts at X + j * ld
+  typedef void (*Kernel)(const float * X, long rows, long ld, float * out);
+
+  inline bool enabled = false;
+  inline string compiler_option = ""; // empty: detect
+  inline int compile_after = 20; // evaluations of a tree before it is compiled
+  inline int max_counted = 1 << 14; // trees whose uses are counted until they are compiled
+
+  struct Entry {
+    int num_uses = 0;
+    bool queued = false;
+    bool done = false; // compiled, or failed to
+    Kernel kernel = NULL;
+    bool counted = false; // in Cache::counted
+    list<string>::iterator counted_pos;
+  };
+
+  struct Cache {
+    mutex m;
+    condition_variable queued, compiled;
+    bool compiler_detected = false;
+    string compiler; // empty: none found
+    string dir; // where sources & shared objects are written
+    unordered_map<string, Entry> entries; // by source
+    list<string> counted; // sources that are neither queued nor compiled, most recently used first
+    deque<string> queue; // sources to compile in the background
+    thread background;
+    bool stopping = false;
+    bool compiling = false; // by the background thread
+    vector<void*> handles;
+    int num_compiled = 0;
+
+    ~Cache() {
+      {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+      }
+      queued.notify_all();
+      if (background.joinable())
+        background.join();
+      // handles that were not released are released by the OS
+      if (!dir.empty())
+        rmdir(dir.c_str());
+    }
+  };
+
+  inline Cache & cache() {
+    static Cache c;
+    return c;
+  }
+
+  inline bool _command_exists(const string & cmd) {
+    if (cmd.empty() || cmd.find_first_of("'\"`$;&|<>") != string::npos)
+      return false;
+    return system(("command -v " + cmd + " >/dev/null 2>&1").c_str()) == 0;
+  }
+
+  // The compiler to use, empty if none is found; cache must be locked
+  inline string _compiler(Cache & c) {
+    if (!c.compiler_detected) {
+      c.compiler_detected = true;
+      vector<string> candidates;
+      if (!compiler_option.empty()) {
+        candidates.push_back(compiler_option);
+      } else {
+        if (getenv("CC"))
+          candidates.push_back(getenv("CC"));
+        candidates.insert(candidates.end(), {"cc", "gcc", "clang"});
+      }
+      for (string & cmd : candidates) {
+        if (_command_exists(cmd)) {
+          c.compiler = cmd;
+          break;
+        }
+      }
+    }
+    return c.compiler;
+  }
+
+  // Whether a compiler is available
+  inline bool available() {
+    Cache & c = cache();
+    lock_guard<mutex> lock(c.m);
+    return !_compiler(c).empty();
+  }
+
+  // Sets up the options; returns whether a compiler is available (if enabled)
+  inline bool configure(bool enable, string compiler, int after=20) {
+    Cache & c = cache();
+    lock_guard<mutex> lock(c.m);
+    enabled = enable;
+    compile_after = max(1, after);
+    if (compiler != compiler_option) {
+      compiler_option = compiler;
+      c.compiler_detected = false;
+    }
+    return !enabled || !_compiler(c).empty();
+  }
+
+  inline string _literal(float v) {
+    if (isnan(v))
+      return "NAN";
+    if (isinf(v))
+      return v > 0 ? "INFINITY" : "(-INFINITY)";
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%af", v); // exact
+    return string("(") + buf + ")";
+  }
+
+  inline bool _has_features(Node * n) {
+    if (n->op->type() == OpType::otFeat)
+      return true;
+    for (int i = 0; i < n->op->arity(); i++)
+      if (_has_features(n->children[i]))
+        return true;
+    return false;
+  }
+
+  // Appends the statements that compute n to body; returns the expression of its value, empty if
+  // an operator cannot be emitted
+  inline string _emit(Node * n, string & body, int & num_vars) {
+    if (!_has_features(n)) {
+      // folded by the interpreter, as in Node::get_output
+      Mat X_none(1, 0);
+      Vec out;
+      float c = 0;
+      n->_get_output_or_constant(X_none, out, c);
+      return _literal(c);
+    }
+    const type_info & t = typeid(*n->op);
+    if (t == typeid(Feat))
+      return "X[" + to_string(((Feat*) n->op)->id) + " * ld + i]";
+
+    vector<string> args;
+    for (int i = 0; i < n->op->arity(); i++) {
+      args.push_back(_emit(n->children[i], body, num_vars));
+      if (args.back().empty())
+        return "";
+    }
+    string v = "v" + to_string(num_vars++);
+    string expr;
+    if (t == typeid(Add))
+      expr = args[0] + " + " + args[1];
+    else if (t == typeid(Sub))
+      expr = args[0] + " - " + args[1];
+    else if (t == typeid(Mul))
+      expr = args[0] + " * " + args[1];
+    else if (t == typeid(Div))
+      expr = args[0] + " / " + args[1];
+    else if (t == typeid(Neg))
+      expr = "-" + args[0];
+    else if (t == typeid(Inv))
+      expr = "1.0f / " + args[0];
+    else if (t == typeid(Square))
+      expr = args[0] + " * " + args[0];
+    else if (t == typeid(Cube))
+      expr = args[0] + " * " + args[0] + " * " + args[0];
+    else if (t == typeid(Sin))
+      expr = "sinf(" + args[0] + ")";
+    else if (t == typeid(Cos))
+      expr = "cosf(" + args[0] + ")";
+    else if (t == typeid(Log) || t == typeid(Sqrt)) {
+      // clip(x, min) as in operator.hpp, i.e., cwiseMin(min) then cwiseMax(INF)
+      string min = t == typeid(Log) ? "1.0f" : "0.0f";
+      body += "    float " + v + " = " + min + " < " + args[0] + " ? " + min + " : " + args[0] + ";\n";
+      body += "    " + v + " = " + v + " < INFINITY ? INFINITY : " + v + ";\n";
+      expr = string(t == typeid(Log) ? "logf(" : "sqrtf(") + v + ")";
+      body += "    " + v + " = " + expr + ";\n";
+      body += "    " + v + " = (" + v + " * SCALE) / SCALE;\n";
+      return v;
+    }
+    else
+      return "";
+    body += "    float " + v + " = " + expr + ";\n";
+    body += "    " + v + " = (" + v + " * SCALE) / SCALE;\n";
+    return v;
+  }
+
+  // C source of the kernel of tree, empty if it has operators that cannot be emitted
+  inline string source(Node * tree) {
+    string body;
+    int num_vars = 0;
+    string result = _emit(tree, body, num_vars);
+    if (result.empty())
+      return "";
+    return "#include <math.h>\n"
+      "#define SCALE " + _literal((float) pow(10.0, NUM_PRECISION)) + "\n"
+      "void gpg_kernel(const float * X, long rows, long ld, float * out) {\n"
+      "  for (long i = 0; i < rows; i++) {\n" + body +
+      "    out[i] = " + result + ";\n"
+      "  }\n"
+      "}\n";
+  }
+
+  // Compiles & loads the source (without holding the lock of the cache); NULL if it failed
+  inline Kernel _compile(Cache & c, const string & src) {
+    string cc, base;
+    {
+      lock_guard<mutex> lock(c.m);
+      cc = _compiler(c);
+      if (cc.empty())
+        return NULL;
+      if (c.dir.empty()) {
+        const char * tmp = getenv("TMPDIR");
+        string templ = string(tmp ? tmp : "/tmp") + "/gpg_jit_XXXXXX";
+        vector<char> path(templ.begin(), templ.end());
+        path.push_back('\0');
+        if (!mkdtemp(path.data()))
+          return NULL;
+        c.dir = path.data();
+      }
+      base = c.dir + "/k" + to_string(hash<string>()(src)) + "_" + to_string(c.num_compiled++);
+    }
+    string c_path = base + ".c", so_path = base + ".so";
+    FILE * f = fopen(c_path.c_str(), "w");
+    if (!f)
+      return NULL;
+    fwrite(src.data(), 1, src.size(), f);
+    fclose(f);
+    // no contraction into FMAs & no fast math, so that the arithmetic is that of the interpreter
+    string cmd = cc + " -O3 -fPIC -shared -ffp-contract=off -fno-math-errno -o '" + so_path + "' '" + c_path + "' -lm >/dev/null 2>&1";
+    int status = system(cmd.c_str());
+    unlink(c_path.c_str());
+    if (status != 0) {
+      unlink(so_path.c_str());
+      return NULL;
+    }
+    void * handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    unlink(so_path.c_str()); // stays mapped
+    if (!handle)
+      return NULL;
+    lock_guard<mutex> lock(c.m);
+    c.handles.push_back(handle);
+    return (Kernel) dlsym(handle, "gpg_kernel");
+  }
+
+  // Compiles the queued sources, one at a time
+  inline void _background_loop(Cache & c) {
+    unique_lock<mutex> lock(c.m);
+    while (true) {
+      c.queued.wait(lock, [&]() { return c.stopping || !c.queue.empty(); });
+      if (c.stopping)
+        return;
+      string src = c.queue.front();
+      c.queue.pop_front();
+      c.compiling = true;
+      lock.unlock();
+      Kernel k = _compile(c, src);
+      lock.lock();
+      Entry & e = c.entries[src];
+      e.kernel = k;
+      e.done = true;
+      c.compiling = false;
+      c.compiled.notify_all();
+    }
+  }
+
+  // Counts a use of the source, and forgets the least recently used sources beyond max_counted;
+  // cache must be locked
+  inline void _count_use(Cache & c, Entry & e, const string & src) {
+    e.num_uses++;
+    if (e.counted) {
+      c.counted.splice(c.counted.begin(), c.counted, e.counted_pos);
+      return;
+    }
+    c.counted.push_front(src);
+    e.counted = true;
+    e.counted_pos = c.counted.begin();
+    while (c.counted.size() > (size_t) max(1, max_counted)) {
+      c.entries.erase(c.counted.back());
+      c.counted.pop_back();
+    }
+  }
+
+  // Queues the source for the background thread; cache must be locked
+  inline void _enqueue(Cache & c, Entry & e, const string & src) {
+    if (e.counted) {
+      c.counted.erase(e.counted_pos);
+      e.counted = false;
+    }
+    if (e.queued)
+      return;
+    e.queued = true;
+    c.queue.push_back(src);
+    if (!c.background.joinable())
+      c.background = thread([&c]() { _background_loop(c); });
+    c.queued.notify_one();
+  }
+
+  // The compiled kernel of tree. If wait, it is compiled right away (if needed); else, this counts as
+  // a use of the tree, which is queued for compilation once used compile_after times, and NULL is
+  // returned until its kernel is ready. NULL if it cannot be compiled
+  inline Kernel kernel(Node * tree, bool wait=false) {
+    string src = source(tree);
+    if (src.empty())
+      return NULL;
+    Cache & c = cache();
+    unique_lock<mutex> lock(c.m);
+    Entry & e = c.entries[src];
+    if (e.done)
+      return e.kernel;
+    if (!wait) {
+      _count_use(c, e, src);
+      if (e.num_uses >= compile_after)
+        _enqueue(c, e, src);
+      return NULL;
+    }
+    _enqueue(c, e, src);
+    c.compiled.wait(lock, [&]() { return c.entries[src].done; });
+    return c.entries[src].kernel;
+  }
+
+  // Unloads all kernels and forgets all trees (e.g., when a session ends), after the compilation in
+  // progress, if any; kernels returned before must not be called anymore, nor may this run concurrently
+  // with evaluations
+  inline void release() {
+    Cache & c = cache();
+    unique_lock<mutex> lock(c.m);
+    c.queue.clear();
+    c.compiled.wait(lock, [&]() { return !c.compiling; });
+    for (void * handle : c.handles)
+      dlclose(handle);
+    c.handles.clear();
+    c.entries.clear();
+    c.counted.clear();
+  }
+
+  // Whether the kernels can read X (it is not packed, see dataset.hpp)
+  inline bool _readable() {
+    return dataset::_input_precision() == dataset::dpFloat32;
+  }
+
+  // Output of tree on X with its compiled kernel; false (and out untouched) if JIT is off or unavailable
+  inline bool compiled_output(Node * tree, const MatRef & X, Vec & out) {
+    if (!enabled || !_readable())
+      return false;
+    Kernel k = kernel(tree);
+    if (!k)
+      return false;
+    out.resize(X.rows());
+    k(X.data(), X.rows(), X.outerStride(), out.data());
+    return true;
+  }
+
+  inline bool & _preferred() {
+    thread_local bool preferred = false;
+    return preferred;
+  }
+
+  // Whether the calling thread evaluates with compiled kernels (see Scope)
+  inline bool preferred() {
+    return enabled && _preferred();
+  }
+
+  // Makes Fitness evaluate with compiled kernels on the calling thread while in scope
+  // (for trees that are evaluated again & again, e.g., the elites)
+  struct Scope {
+    bool previous;
+
+    Scope() {
+      previous = _preferred();
+      _preferred() = true;
+    }
+
+    ~Scope() {
+      _preferred() = previous;
+    }
+  };
+
+}
+
+#endif
@@ -7,12 +7,20 @@
 #include "ims.hpp"
 #include "node.hpp"
 #include "tests.hpp"
+#include "benchmark.hpp"
 
 using namespace myeig;
 
 int main(int argc, char** argv){
   g::read_options(argc, argv);
 
+  // the benchmark sets its own data (the tests need the terminals of a training set)
+  if (!g::ttt_datasets.empty()) {
+    ttt::run_benchmark();
+    g::clear_globals();
+    return 0;
+  }
+
   auto t = Test();
   t.run_all();
 
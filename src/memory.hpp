@@ -0,0 +1,174 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "myeig.hpp"
+#include "node.hpp"
+#include "util.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Memory accounting per subsystem: populations, elite archive, linkage (MI matrices, bias `B` and
+  discretized populations), dataset copies, and evaluation caches.
+  Long-lived structures are (re-)measured by IMS (see IMS::account_memory) by walking them, which is
+  only done if there is a budget or the report is printed (see `measuring`), while short-lived ones
+  (e.g., offspring populations, caches of the population-level evaluation) are accounted for while
+  they exist with `Scoped`. Sizes are estimates of the heap footprint (including
+  a per-allocation overhead), current and peak values are kept per subsystem and overall.
+  `max_bytes` (option `-max_memory`) is the budget IMS uses to decide whether a new evolution fits.
+*/
+
+namespace mem {
+
+  enum Subsystem {
+    msPopulations, msElites, msLinkage, msDataset, msCaches, NUM_SUBSYSTEMS
+  };
+
+  inline const char * subsystem_names[NUM_SUBSYSTEMS] = {
+    "populations", "elites", "linkage", "dataset", "caches"
+  };
+
+  inline long long max_bytes = 0; // 0: no limit
+
+  inline atomic<long long> current[NUM_SUBSYSTEMS];
+  inline atomic<long long> peak[NUM_SUBSYSTEMS];
+  inline atomic<long long> current_total{0};
+  inline atomic<long long> peak_total{0};
+
+  const long long ALLOC_OVERHEAD = 16;
+  const long long OP_BYTES = 32; // operators are small, and polymorphic
+
+  // Whether long-lived structures are measured (by walking them): only for a budget, or for the report (see IMS::run)
+  inline bool measuring() {
+    return max_bytes > 0 || g::verbose;
+  }
+
+  inline void _update_peak(atomic<long long> & p, long long value) {
+    long long prev = p.load(memory_order_relaxed);
+    while (value > prev && !p.compare_exchange_weak(prev, value, memory_order_relaxed));
+  }
+
+  inline void add(Subsystem s, long long delta) {
+    long long value = current[s].fetch_add(delta, memory_order_relaxed) + delta;
+    long long total = current_total.fetch_add(delta, memory_order_relaxed) + delta;
+    _update_peak(peak[s], value);
+    _update_peak(peak_total, total);
+  }
+
+  inline void set(Subsystem s, long long bytes) {
+    add(s, bytes - current[s].load(memory_order_relaxed));
+  }
+
+  inline void reset() {
+    for (int s = 0; s < NUM_SUBSYSTEMS; s++) {
+      current[s] = 0;
+      peak[s] = 0;
+    }
+    current_total = 0;
+    peak_total = 0;
+  }
+
+  // Accounts for a short-lived structure while in scope
+  struct Scoped {
+    Subsystem s;
+    long long bytes;
+
+    Scoped(Subsystem s, long long bytes) {
+      this->s = s;
+      this->bytes = bytes;
+      add(s, bytes);
+    }
+
+    ~Scoped() {
+      add(s, -bytes);
+    }
+  };
+
+  template<typename T>
+  inline long long bytes_of(const T & m) {
+    return m.size() * (long long) sizeof(typename T::Scalar) + (m.size() > 0 ? ALLOC_OVERHEAD : 0);
+  }
+
+  inline long long tree_bytes(Node * n) {
+    long long bytes = sizeof(Node) + OP_BYTES + 2 * ALLOC_OVERHEAD;
+    if (n->children.capacity() > 0)
+      bytes += n->children.capacity() * sizeof(Node*) + ALLOC_OVERHEAD;
+    if (n->active_mask)
+      bytes += sizeof(vector<bool>) + n->active_mask->capacity() / 8 + 2 * ALLOC_OVERHEAD;
+    for (Node * c : n->children)
+      bytes += tree_bytes(c);
+    return bytes;
+  }
+
+  inline long long trees_bytes(vector<Node*> & trees) {
+    long long bytes = trees.capacity() * sizeof(Node*);
+    for (Node * t : trees)
+      if (t)
+        bytes += tree_bytes(t);
+    return bytes;
+  }
+
+  // Number of nodes of the full template, with the given depth & max. arity
+  inline long long template_num_nodes(int max_depth, int max_arity) {
+    long long num_nodes = 0, level = 1;
+    for (int d = 0; d <= max_depth; d++) {
+      num_nodes += level;
+      level *= max_arity;
+    }
+    return num_nodes;
+  }
+
+  // Estimate for a tree of the full template (all trees have its shape, introns included)
+  inline long long template_tree_bytes(int max_depth, int max_arity) {
+    long long num_nodes = template_num_nodes(max_depth, max_arity);
+    long long internal_nodes = max_depth > 0 ? template_num_nodes(max_depth - 1, max_arity) : 0;
+    return num_nodes * (sizeof(Node) + OP_BYTES + 2 * ALLOC_OVERHEAD)
+      + internal_nodes * (max_arity * sizeof(Node*) + ALLOC_OVERHEAD)
+      + sizeof(vector<bool>) + num_nodes / 8 + 2 * ALLOC_OVERHEAD;
+  }
+
+  // Resident set size of the process (current & peak), as reported by the OS (0 if unknown)
+  inline pair<long long, long long> process_rss() {
+    long long rss = 0, peak_rss = 0;
+    ifstream statm("/proc/self/statm");
+    long long size, resident;
+    if (statm >> size >> resident)
+      rss = resident * sysconf(_SC_PAGESIZE);
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+      peak_rss = usage.ru_maxrss * 1024LL;
+    return make_pair(rss, peak_rss);
+  }
+
+  inline string mb(long long bytes) {
+    stringstream ss;
+    ss.precision(1);
+    ss << fixed << bytes / (1024.0 * 1024.0) << " MB";
+    return ss.str();
+  }
+
+  inline string report() {
+    stringstream ss;
+    ss << "memory (current / peak):";
+    for (int s = 0; s < NUM_SUBSYSTEMS; s++)
+      ss << " " << subsystem_names[s] << " " << mb(current[s]) << " / " << mb(peak[s]) << ",";
+    ss << " accounted " << mb(current_total) << " / " << mb(peak_total);
+    auto rss = process_rss();
+    ss << ", process RSS " << mb(rss.first) << " / " << mb(rss.second);
+    if (max_bytes > 0)
+      ss << ", budget " << mb(max_bytes);
+    return ss.str();
+  }
+
+}
+
+#endif
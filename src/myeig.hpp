@@ -11,6 +11,9 @@ namespace myeig {
   typedef Eigen::ArrayXXf Mat;
   typedef Eigen::ArrayXf Vec;
   typedef Eigen::ArrayXi Veci;
+  // read-only views of a Mat / Vec, or of memory laid out as one (e.g., mapped), without copying it
+  typedef Eigen::Ref<const Mat> MatRef;
+  typedef Eigen::Ref<const Vec> VecRef;
 }
 
 #endif
\ No newline at end of file
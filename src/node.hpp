@@ -1,6 +1,7 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <array>
 #include <vector>
 #include "operator.hpp"
 #include "util.hpp"
@@ -13,6 +14,9 @@ struct Node {
   vector<Node*> children;
   Op * op = NULL;
   float fitness;
+  // pre-order activity mask & number of active (i.e., non-intron) nodes, only maintained on roots
+  int num_active_nodes = -1;
+  vector<bool> * active_mask = NULL;
 
   //Node() {};
 
@@ -23,6 +27,8 @@ struct Node {
   virtual ~Node() noexcept(false) {
     if (op)
       delete op;
+    if (active_mask)
+      delete active_mask;
   }
 
   void clear() {
@@ -36,6 +42,10 @@ struct Node {
   Node * clone() {
     Node * new_node = new Node(this->op->clone());
     new_node->fitness = this->fitness;
+    if (this->active_mask) {
+      new_node->active_mask = new vector<bool>(*this->active_mask);
+      new_node->num_active_nodes = this->num_active_nodes;
+    }
     for(Node * c : this->children) {
       Node * new_c = c->clone();
       new_node->append(new_c);
@@ -94,6 +104,12 @@ struct Node {
   }
 
   int get_num_nodes(bool excl_introns=false) {
+    if (excl_introns && !parent) {
+      // roots keep track of their active nodes
+      get_active_mask();
+      return num_active_nodes;
+    }
+
     auto nodes = this->subtree();
     int n = nodes.size();
     if (!excl_introns) 
@@ -159,16 +175,106 @@ struct Node {
     return false;
   }
 
-  Vec get_output(Mat & X) {
+  // (Re)computes the activity mask of the tree rooted in this node
+  void refresh_activity() {
+    if (!active_mask)
+      active_mask = new vector<bool>();
+    active_mask->clear();
+    num_active_nodes = 0;
+    int pos = 0;
+    _update_activity_recursive(true, pos, true);
+  }
+
+  // Updates the activity mask of the tree rooted in this node after the arity of the 
+  // operator of nodes[pos] changed, where nodes is the pre-order list of nodes of this tree
+  void update_activity(vector<Node*> & nodes, int pos) {
+    if (!active_mask) {
+      refresh_activity();
+      return;
+    }
+    nodes[pos]->_update_activity_recursive((*active_mask)[pos], pos, false, this);
+  }
+
+  void _update_activity_recursive(bool active, int & pos, bool append, Node * root=NULL) {
+    if (!root)
+      root = this;
+    vector<bool> & mask = *root->active_mask;
+    if (append) {
+      mask.push_back(active);
+      if (active)
+        root->num_active_nodes++;
+    } else if (mask[pos] != active) {
+      mask[pos] = active;
+      root->num_active_nodes += active ? 1 : -1;
+    }
+    pos++;
+    int a = op->arity();
+    for(int i = 0; i < children.size(); i++)
+      children[i]->_update_activity_recursive(active && i < a, pos, append, root);
+  }
+
+  vector<bool> & get_active_mask() {
+    assert(!parent);
+    if (!active_mask)
+      refresh_activity();
+    return *active_mask;
+  }
+
+  Vec get_output(const MatRef & X) {
+    Vec out;
+    float c;
+    if (_get_output_or_constant(X, out, c))
+      return Vec::Constant(X.rows(), c);
+    return out;
+  }
+
+  // Returns true (and sets c instead of out) if the output of the subtree does not depend on the features.
+  // Feature-free subtrees are thus computed as scalars, and broadcast only when they meet a feature-dependent branch
+  bool _get_output_or_constant(const MatRef & X, Vec & out, float & c) {
     int a = op->arity();
-    if (a == 0)
-      return op->apply(X);
+    if (a == 0) {
+      if (op->type() == OpType::otConst) {
+        Const * k = (Const*) op;
+        if (isnan(k->c))
+          k->_sample();
+        c = k->c;
+        return true;
+      }
+      out = dataset::feature(X, ((Feat*) op)->id); // (as Feat::apply, which needs a Mat)
+      return false;
+    }
 
-    Mat C(X.rows(), a);
+    assert(a <= MAX_ARITY);
+    Mat C;
+    array<float, MAX_ARITY> child_consts;
+    array<bool, MAX_ARITY> child_is_const;
+    bool all_const = true;
+    for(int i = 0; i < a; i++) {
+      Vec child_out;
+      child_is_const[i] = children[i]->_get_output_or_constant(X, child_out, child_consts[i]);
+      if (!child_is_const[i]) {
+        if (all_const)
+          C = Mat(X.rows(), a);
+        all_const = false;
+        C.col(i) = child_out;
+      }
+    }
+
+    if (all_const) {
+      Mat c_row(1, a);
+      for(int i = 0; i < a; i++)
+        c_row(0, i) = child_consts[i];
+      c = ((op->apply(c_row) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION))[0];
+      return true;
+    }
+
+    // broadcast constant inputs
     for(int i = 0; i < a; i++)
-      C.col(i) = children[i]->get_output(X);
+      if (child_is_const[i])
+        C.col(i).setConstant(child_consts[i]);
 
-    return (op->apply(C) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION);
+    out = (op->apply(C) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION);
+    return false;
   }
 
   string str_subtree() {
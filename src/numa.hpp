@@ -0,0 +1,230 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "myeig.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  NUMA-aware evaluation (option `-numa`, Linux only).
+  The nodes and their cpus are read from /sys/devices/system/node. The threads of the scheduler
+  (see scheduler.hpp) are pinned to the cpus of a node, round-robin over the nodes (worker w on
+  node w % number of nodes). The calling thread, worker 0, is pinned to node 0 only while it runs
+  a parallel loop, and gets its affinity back at the end (see CallerPlacement), so that the threads
+  of an application that calls the library are not left restricted to one node. The data evaluations read (the
+  batch, and the training set) is replicated once per node: the copy of a node is allocated and
+  written by the first thread of that node that needs it, so that its pages are placed on that
+  node (first touch), and it is refreshed when the batch changes. Threads then evaluate against
+  the copy of their node, instead of reading a single copy across the interconnect.
+  Threads that were not placed on a node (e.g., when the option is off) use the original data.
+*/
+
+namespace numa {
+
+  const int MAX_NODES = 64;
+
+  inline bool enabled = false;
+  inline vector<vector<int>> node_cpus; // cpus of each node
+  inline atomic<int> epoch{0}; // incremented when the placement changes
+  inline atomic<long long> node_bytes[MAX_NODES]; // bytes of the replicas on each node
+
+  inline vector<int> _parse_cpulist(string list) {
+    // e.g., "0-3,8-11"
+    vector<int> cpus;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+      if (range.empty() || range == "\n")
+        continue;
+      size_t dash = range.find('-');
+      int first = stoi(range.substr(0, dash));
+      int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+      for (int c = first; c <= last; c++)
+        cpus.push_back(c);
+    }
+    return cpus;
+  }
+
+  // Reads the topology; a single node with all cpus if it is not available
+  inline vector<vector<int>> detect() {
+    vector<vector<int>> nodes;
+    for (int n = 0; n < MAX_NODES; n++) {
+      ifstream f("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+      string list;
+      if (!f.is_open() || !getline(f, list))
+        break;
+      vector<int> cpus = _parse_cpulist(list);
+      if (!cpus.empty())
+        nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+      vector<int> cpus;
+      for (int c = 0; c < max(1, (int) thread::hardware_concurrency()); c++)
+        cpus.push_back(c);
+      nodes.push_back(cpus);
+    }
+    return nodes;
+  }
+
+  inline int num_nodes() {
+    return node_cpus.size();
+  }
+
+  inline void configure(bool enable) {
+    enabled = enable;
+    if (enabled && node_cpus.empty())
+      node_cpus = detect();
+    epoch++;
+  }
+
+  inline int & _current_node() {
+    thread_local int node = -1;
+    return node;
+  }
+
+  // Node the calling thread is placed on (-1 if none)
+  inline int current_node() {
+    return _current_node();
+  }
+
+  inline bool _set_affinity(vector<int> & cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+      if (c < CPU_SETSIZE)
+        CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // Pins the calling thread, worker w > 0 of the scheduler, to its node (or unpins it if disabled);
+  // cheap when the placement did not change since the last call
+  inline void place_thread(int w) {
+    thread_local int placed_epoch = 0;
+    thread_local bool pinned = false;
+    int curr_epoch = epoch.load(memory_order_relaxed);
+    if (placed_epoch == curr_epoch)
+      return;
+    placed_epoch = curr_epoch;
+    if (enabled && !node_cpus.empty()) {
+      int n = w % num_nodes();
+      pinned = _set_affinity(node_cpus[n]);
+      _current_node() = pinned ? n : -1;
+    } else {
+      if (pinned) {
+        vector<int> all_cpus;
+        for (auto & cpus : detect())
+          all_cpus.insert(all_cpus.end(), cpus.begin(), cpus.end());
+        _set_affinity(all_cpus);
+      }
+      pinned = false;
+      _current_node() = -1;
+    }
+  }
+
+  // Pins the calling thread (worker 0) to node 0 while in scope, then restores its affinity
+  struct CallerPlacement {
+#ifdef __linux__
+    cpu_set_t previous;
+#endif
+    bool pinned = false;
+    int previous_node;
+
+    CallerPlacement() {
+      previous_node = _current_node();
+      if (!enabled || node_cpus.empty())
+        return;
+#ifdef __linux__
+      if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0)
+        return;
+#endif
+      pinned = _set_affinity(node_cpus[0]);
+      if (pinned)
+        _current_node() = 0;
+    }
+
+    ~CallerPlacement() {
+#ifdef __linux__
+      if (pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+#endif
+      _current_node() = previous_node;
+    }
+  };
+
+  // Copies of a (read-only) matrix & vector, one per node
+  struct Replicas {
+    struct Copy {
+      mutex m;
+      atomic<uint64_t> version{0}; // version of the source + 1, 0: none
+      Mat X;
+      Vec y;
+      long long bytes = 0;
+    };
+
+    Copy copies[MAX_NODES];
+
+    ~Replicas() {
+      for (int n = 0; n < MAX_NODES; n++)
+        node_bytes[n] -= copies[n].bytes;
+    }
+
+    // The copy on the node of the calling thread, (re-)made from X & y if older than version;
+    // NULL if the thread is not placed on a node
+    Copy * local(Mat & X, Vec & y, uint64_t version) {
+      int n = current_node();
+      if (n < 0)
+        return NULL;
+      Copy & c = copies[n];
+      if (c.version.load(memory_order_acquire) != version + 1) {
+        lock_guard<mutex> lock(c.m);
+        if (c.version.load(memory_order_relaxed) != version + 1) {
+          // written by this thread, so first touch places the pages on this node
+          c.X = X;
+          c.y = y;
+          long long bytes = (c.X.size() + c.y.size()) * (long long) sizeof(float);
+          node_bytes[n] += bytes - c.bytes;
+          c.bytes = bytes;
+          c.version.store(version + 1, memory_order_release);
+        }
+      }
+      return &c;
+    }
+
+    long long total_bytes() {
+      long long bytes = 0;
+      for (int n = 0; n < MAX_NODES; n++)
+        bytes += copies[n].bytes;
+      return bytes;
+    }
+  };
+
+  inline string report() {
+    stringstream ss;
+    ss.precision(1);
+    ss << "NUMA replicas:";
+    for (int n = 0; n < num_nodes(); n++)
+      ss << (n > 0 ? "," : "") << " node " << n << " (" << node_cpus[n].size() << " cpus) "
+        << fixed << node_bytes[n] / (1024.0 * 1024.0) << " MB";
+    return ss.str();
+  }
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define OPERATOR_H
 
 #include "myeig.hpp"
+#include "dataset.hpp"
 #include "util.hpp"
 #include "rng.hpp"
 
@@ -9,11 +10,15 @@ using namespace std;
 using namespace myeig;
 
 // IMPORTANT: All operators need to be defined in globals.h's `all_operators` field to be accessible
+// Functions implement their kernel as a static `eval` on the input columns, which `apply` calls on
+// the columns of X, and which the specialized evaluators (see specialized.hpp) call directly
 
 enum OpType {
   otFun, otFeat, otConst
 };
 
+const int MAX_ARITY = 2; // of all operators
+
 struct Op {
 
   virtual ~Op(){};
@@ -96,8 +101,13 @@ struct Add : Fun {
     return "+";
   }
 
+  template<typename A, typename B>
+  static Vec eval(const A & a, const B & b) {
+    return a + b;
+  }
+
   Vec apply(Mat & X) override {
-    return X.rowwise().sum();
+    return eval(X.col(0), X.col(1));
   }
 
 };
@@ -116,8 +126,13 @@ struct Neg : Fun {
     return "¬";
   }
 
+  template<typename A>
+  static Vec eval(const A & a) {
+    return -a;
+  }
+
   Vec apply(Mat & X) override {
-    return -X.col(0);
+    return eval(X.col(0));
   }
 
 };
@@ -136,8 +151,13 @@ struct Sub : Fun {
     return "-";
   }
 
+  template<typename A, typename B>
+  static Vec eval(const A & a, const B & b) {
+    return a - b;
+  }
+
   Vec apply(Mat & X) override {
-    return X.col(0)-X.col(1);
+    return eval(X.col(0), X.col(1));
   }
 
 };
@@ -156,8 +176,13 @@ struct Mul : Fun {
     return "*";
   }
   
+  template<typename A, typename B>
+  static Vec eval(const A & a, const B & b) {
+    return a * b;
+  }
+
   Vec apply(Mat & X) override {
-    return X.col(0)*X.col(1);
+    return eval(X.col(0), X.col(1));
   }
 
 };
@@ -177,13 +202,18 @@ struct Inv : Fun {
   }
 
   
-  Vec apply(Mat & X) override {
+  template<typename A>
+  static Vec eval(const A & a) {
     // division by 0 is undefined thus conver to NAN
-    Vec denom = X.col(0);
+    Vec denom = a;
     replace(denom, 0, NAN);
     return 1/denom;
   }
 
+  Vec apply(Mat & X) override {
+    return eval(X.col(0));
+  }
+
 };
 
 struct Div : Fun {
@@ -200,11 +230,16 @@ struct Div : Fun {
     return "/";
   }
 
-  Vec apply(Mat & X) override {
+  template<typename A, typename B>
+  static Vec eval(const A & a, const B & b) {
     // division by 0 is undefined thus convert to NAN
-    Vec denom = X.col(1);
+    Vec denom = b;
     replace(denom, 0, NAN);
-    return X.col(0)/denom;
+    return a/denom;
+  }
+
+  Vec apply(Mat & X) override {
+    return eval(X.col(0), X.col(1));
   }
 
 };
@@ -223,8 +258,13 @@ struct Sin : Fun {
     return "sin";
   }
 
+  template<typename A>
+  static Vec eval(const A & a) {
+    return a.sin();
+  }
+
   Vec apply(Mat & X) override {
-    return X.sin();
+    return eval(X.col(0));
   }
 
 };
@@ -243,8 +283,13 @@ struct Cos : Fun {
     return "cos";
   }
 
+  template<typename A>
+  static Vec eval(const A & a) {
+    return a.cos();
+  }
+
   Vec apply(Mat & X) override {
-    return X.cos();
+    return eval(X.col(0));
   }
 
 };
@@ -263,12 +308,17 @@ struct Log : Fun {
     return "log";
   }
 
-  Vec apply(Mat & X) override {
+  template<typename A>
+  static Vec eval(const A & a) {
     // Log of x < 0 is undefined and log of 0 is -inf
-    Vec x = X.col(0);
+    Vec x = a;
     return (clip(x, 1.0)).log();
   }
 
+  Vec apply(Mat & X) override {
+    return eval(X.col(0));
+  }
+
   string human_repr(vector<string> & args) override {
     return "sqrt(max(1.0,"+args[0]+"))";
   }
@@ -289,12 +339,17 @@ struct Sqrt : Fun {
     return "sqrt";
   }
 
-  Vec apply(Mat & X) override {
+  template<typename A>
+  static Vec eval(const A & a) {
     // Sqrt of x < 0 is undefined
-    Vec x = X.col(0);
+    Vec x = a;
     return (clip(x, 0)).sqrt();
   }
 
+  Vec apply(Mat & X) override {
+    return eval(X.col(0));
+  }
+
   string human_repr(vector<string> & args) override {
     return "sqrt(max(0,"+args[0]+"))";
   }
@@ -319,9 +374,13 @@ struct Square : Fun {
     return _human_repr_unary_after(args);
   }
 
+  template<typename A>
+  static Vec eval(const A & a) {
+    return a.square();
+  }
+
   Vec apply(Mat & X) override {
-    Vec x = X.col(0);
-    return x.square();
+    return eval(X.col(0));
   }
 
 };
@@ -344,9 +403,13 @@ struct Cube : Fun {
     return _human_repr_unary_after(args);
   }
 
+  template<typename A>
+  static Vec eval(const A & a) {
+    return a.cube();
+  }
+
   Vec apply(Mat & X) override {
-    Vec x = X.col(0);
-    return x.cube();
+    return eval(X.col(0));
   }
 
 };
@@ -376,7 +439,7 @@ struct Feat : Term {
   }
 
   Vec apply(Mat & X) override {
-    return X.col(id);
+    return dataset::feature(X, id); // (widened if X is packed)
   }
 
 };
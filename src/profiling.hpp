@@ -0,0 +1,287 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hwcounters.hpp"
+
+using namespace std;
+
+/*
+  Per-phase profiling of the search.
+  Scoped timers accumulate the time and the number of calls of each phase into global counters.
+  Times are inclusive (e.g., `gom` includes the `evaluation` of the offspring) and nested timers
+  of the same phase on the same thread are counted once. When profiling is disabled, a timer
+  costs a single branch. IMS::run snapshots the counters around the generation of each
+  evolution and around each macro generation, and emits the differences as records.
+  With `-profile_hw`, timers also accumulate the hardware counters of hwcounters.hpp, and records
+  report them per phase, as well as per node evaluation (`evaluation`) and per MI pair (`linkage_mi`),
+  which tells whether these kernels are compute- or memory-bound on the data set at hand.
+  Counters are per thread: work that a phase spreads over the scheduler adds the counts of the other
+  threads with `ScopedCounters`.
+*/
+
+namespace prof {
+
+  enum Phase {
+    phInitEvolution, phBatchUpdate, phLinkage, phMI, phUPGMA, phGOM, phEvaluation,
+    phUpdateElites, phTerminateEvolutions, NUM_PHASES
+  };
+
+  inline const char * phase_names[NUM_PHASES] = {
+    "init_evolution", "batch_update", "linkage", "linkage_mi", "linkage_upgma", "gom", "evaluation",
+    "update_elites", "terminate_evolutions"
+  };
+
+  inline bool enabled = false;
+
+  inline atomic<long long> total_ns[NUM_PHASES];
+  inline atomic<long long> total_calls[NUM_PHASES];
+  inline atomic<long long> total_hw[NUM_PHASES][hw::NUM_COUNTERS];
+  inline atomic<long long> total_mi_pairs;
+
+  struct Totals {
+    long long ns[NUM_PHASES] = {};
+    long long calls[NUM_PHASES] = {};
+    long long hw[NUM_PHASES][hw::NUM_COUNTERS] = {};
+    long long mi_pairs = 0;
+  };
+
+  inline Totals snapshot() {
+    Totals t;
+    for(int p = 0; p < NUM_PHASES; p++) {
+      t.ns[p] = total_ns[p].load(memory_order_relaxed);
+      t.calls[p] = total_calls[p].load(memory_order_relaxed);
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        t.hw[p][c] = total_hw[p][c].load(memory_order_relaxed);
+    }
+    t.mi_pairs = total_mi_pairs.load(memory_order_relaxed);
+    return t;
+  }
+
+  // Pairs of variables for which the MI is estimated (to normalize the counters of `linkage_mi`)
+  inline void count_mi_pairs(long long num_pairs) {
+    if (enabled)
+      total_mi_pairs.fetch_add(num_pairs, memory_order_relaxed);
+  }
+
+  inline chrono::steady_clock::time_point now() {
+    return chrono::steady_clock::now();
+  }
+
+  inline double elapsed(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  inline int * _depths() {
+    thread_local int depths[NUM_PHASES] = {};
+    return depths;
+  }
+
+  struct ScopedTimer {
+    Phase phase;
+    bool tracked = false;
+    bool counted = false;
+    chrono::steady_clock::time_point start;
+    hw::Counts start_hw;
+
+    ScopedTimer(Phase phase) {
+      this->phase = phase;
+      if (!enabled)
+        return;
+      tracked = true;
+      if (_depths()[phase]++ == 0) {
+        counted = true;
+        if (hw::enabled)
+          start_hw = hw::read();
+        start = chrono::steady_clock::now();
+      }
+    }
+
+    ~ScopedTimer() {
+      if (!tracked)
+        return;
+      _depths()[phase]--;
+      if (counted) {
+        long long ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        total_ns[phase].fetch_add(ns, memory_order_relaxed);
+        total_calls[phase].fetch_add(1, memory_order_relaxed);
+        if (hw::enabled) {
+          hw::Counts end_hw = hw::read();
+          for(int c = 0; c < hw::NUM_COUNTERS; c++)
+            total_hw[phase][c].fetch_add(end_hw.v[c] - start_hw.v[c], memory_order_relaxed);
+        }
+      }
+    }
+  };
+
+  // Adds the hardware counters of the calling thread to phase while in scope, unless the thread times
+  // the phase itself (e.g., a task of the scheduler run by another thread than the one of the timer)
+  struct ScopedCounters {
+    Phase phase;
+    bool counted = false;
+    hw::Counts start_hw;
+
+    ScopedCounters(Phase phase) {
+      this->phase = phase;
+      if (!enabled || !hw::enabled || _depths()[phase] > 0)
+        return;
+      counted = true;
+      start_hw = hw::read();
+    }
+
+    ~ScopedCounters() {
+      if (!counted)
+        return;
+      hw::Counts end_hw = hw::read();
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        total_hw[phase][c].fetch_add(end_hw.v[c] - start_hw.v[c], memory_order_relaxed);
+    }
+  };
+
+  struct Record {
+    int macro_generation;
+    int evolution; // -1 for the whole macro generation
+    int pop_size;
+    double wall_seconds;
+    long long evaluations;
+    long long node_evaluations;
+    long long mi_pairs;
+    double seconds[NUM_PHASES];
+    long long calls[NUM_PHASES];
+    long long hw[NUM_PHASES][hw::NUM_COUNTERS]; // zeros unless hw::enabled
+
+    // hardware counter c of phase p per unit of work (0 if no work was done)
+    double hw_per(Phase p, int c, long long units) {
+      return units > 0 ? hw[p][c] / (double) units : 0;
+    }
+  };
+
+  // records of the last run (e.g., returned to Python)
+  inline vector<Record> records;
+  inline string out_path;
+  inline ofstream out_file;
+
+  inline bool _csv() {
+    return out_path.size() >= 4 && out_path.substr(out_path.size() - 4) == ".csv";
+  }
+
+  // Enables profiling; records are also written to path (as CSV if it ends with .csv, else as JSON lines)
+  inline void enable(string path="") {
+    enabled = true;
+    if (out_file.is_open())
+      out_file.close();
+    out_path = path;
+    if (out_path.empty())
+      return;
+    out_file.open(out_path);
+    if (!out_file.is_open())
+      throw runtime_error("Cannot open the profiling output file: "+out_path);
+    if (_csv()) {
+      out_file << "macro_generation,evolution,pop_size,wall_seconds,evaluations,node_evaluations,mi_pairs";
+      for(int p = 0; p < NUM_PHASES; p++)
+        out_file << "," << phase_names[p] << "_seconds," << phase_names[p] << "_calls";
+      if (hw::enabled) {
+        for(int p = 0; p < NUM_PHASES; p++)
+          for(int c = 0; c < hw::NUM_COUNTERS; c++)
+            out_file << "," << phase_names[p] << "_" << hw::counter_names[c];
+        for(int c = 0; c < hw::NUM_COUNTERS; c++)
+          out_file << ",evaluation_" << hw::counter_names[c] << "_per_node_evaluation";
+        for(int c = 0; c < hw::NUM_COUNTERS; c++)
+          out_file << ",linkage_mi_" << hw::counter_names[c] << "_per_pair";
+      }
+      out_file << "\n";
+    }
+  }
+
+  inline void disable() {
+    enabled = false;
+    if (out_file.is_open())
+      out_file.close();
+    out_path = "";
+    records.clear();
+  }
+
+  inline string to_json(Record & r) {
+    stringstream ss;
+    ss << "{\"macro_generation\": " << r.macro_generation << ", \"evolution\": " << r.evolution
+      << ", \"pop_size\": " << r.pop_size << ", \"wall_seconds\": " << r.wall_seconds
+      << ", \"evaluations\": " << r.evaluations << ", \"node_evaluations\": " << r.node_evaluations
+      << ", \"mi_pairs\": " << r.mi_pairs;
+    ss << ", \"seconds\": {";
+    for(int p = 0; p < NUM_PHASES; p++)
+      ss << (p > 0 ? ", " : "") << "\"" << phase_names[p] << "\": " << r.seconds[p];
+    ss << "}, \"calls\": {";
+    for(int p = 0; p < NUM_PHASES; p++)
+      ss << (p > 0 ? ", " : "") << "\"" << phase_names[p] << "\": " << r.calls[p];
+    ss << "}";
+    if (hw::enabled) {
+      ss << ", \"hw_available\": " << (hw::available ? "true" : "false") << ", \"hw\": {";
+      for(int p = 0; p < NUM_PHASES; p++) {
+        ss << (p > 0 ? ", " : "") << "\"" << phase_names[p] << "\": {";
+        for(int c = 0; c < hw::NUM_COUNTERS; c++)
+          ss << (c > 0 ? ", " : "") << "\"" << hw::counter_names[c] << "\": " << r.hw[p][c];
+        ss << "}";
+      }
+      ss << "}, \"hw_per_node_evaluation\": {";
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        ss << (c > 0 ? ", " : "") << "\"" << hw::counter_names[c] << "\": " << r.hw_per(phEvaluation, c, r.node_evaluations);
+      ss << "}, \"hw_per_mi_pair\": {";
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        ss << (c > 0 ? ", " : "") << "\"" << hw::counter_names[c] << "\": " << r.hw_per(phMI, c, r.mi_pairs);
+      ss << "}";
+    }
+    ss << "}";
+    return ss.str();
+  }
+
+  inline string to_csv(Record & r) {
+    stringstream ss;
+    ss << r.macro_generation << "," << r.evolution << "," << r.pop_size << "," << r.wall_seconds
+      << "," << r.evaluations << "," << r.node_evaluations << "," << r.mi_pairs;
+    for(int p = 0; p < NUM_PHASES; p++)
+      ss << "," << r.seconds[p] << "," << r.calls[p];
+    if (hw::enabled) {
+      for(int p = 0; p < NUM_PHASES; p++)
+        for(int c = 0; c < hw::NUM_COUNTERS; c++)
+          ss << "," << r.hw[p][c];
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        ss << "," << r.hw_per(phEvaluation, c, r.node_evaluations);
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        ss << "," << r.hw_per(phMI, c, r.mi_pairs);
+    }
+    return ss.str();
+  }
+
+  // Stores (and writes out) the difference between two snapshots
+  inline void emit(int macro_generation, int evolution, int pop_size, double wall_seconds,
+    long long evaluations, long long node_evaluations, Totals & before, Totals & after) {
+    Record r;
+    r.macro_generation = macro_generation;
+    r.evolution = evolution;
+    r.pop_size = pop_size;
+    r.wall_seconds = wall_seconds;
+    r.evaluations = evaluations;
+    r.node_evaluations = node_evaluations;
+    r.mi_pairs = after.mi_pairs - before.mi_pairs;
+    for(int p = 0; p < NUM_PHASES; p++) {
+      r.seconds[p] = (after.ns[p] - before.ns[p]) / 1e9;
+      r.calls[p] = after.calls[p] - before.calls[p];
+      for(int c = 0; c < hw::NUM_COUNTERS; c++)
+        r.hw[p][c] = after.hw[p][c] - before.hw[p][c];
+    }
+    records.push_back(r);
+    if (out_file.is_open()) {
+      out_file << (_csv() ? to_csv(r) : to_json(r)) << "\n";
+      out_file.flush();
+    }
+  }
+
+}
+
+#endif
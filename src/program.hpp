@@ -0,0 +1,270 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "myeig.hpp"
+#include "node.hpp"
+#include "operator.hpp"
+#include "util.hpp"
+#include "jit.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Compact binary format of a model, meant for serving.
+  A program is the active part of a tree in post-order, one instruction per node:
+    header:       "GPGP" | version (uint8) | number of features needed (uint32) | number of instructions (uint32)
+    instruction:  opcode (uint8) [ | feature index (int32) if opcode is `feat` | value (float32) if opcode is `const` ]
+  Opcodes are positions in `program_symbols`, which must only ever be appended to, so that
+  stored programs remain valid. Decoding a program needs neither the globals nor sympy.
+
+  A genotype is instead the whole tree, introns included, in pre-order (e.g., to move
+  individuals between populations that share the template):
+    header:       "GPGG" | version (uint8) | number of nodes (uint32)
+    node:         opcode (uint8) | number of children (uint8) [ | feature index or value, as above ]
+*/
+
+const char PROGRAM_MAGIC[4] = {'G','P','G','P'};
+const uint8_t PROGRAM_VERSION = 1;
+const char GENOTYPE_MAGIC[4] = {'G','P','G','G'};
+const uint8_t GENOTYPE_VERSION = 1;
+const uint8_t OPCODE_FEAT = 0;
+const uint8_t OPCODE_CONST = 1;
+const vector<string> program_symbols = {
+  "x", "c", "+", "-", "¬", "*", "/", "1/", "**2", "sqrt", "**3", "sin", "cos", "log"
+};
+
+inline Op * _new_function_op(uint8_t opcode) {
+  switch (opcode) {
+    case 2: return new Add();
+    case 3: return new Sub();
+    case 4: return new Neg();
+    case 5: return new Mul();
+    case 6: return new Div();
+    case 7: return new Inv();
+    case 8: return new Square();
+    case 9: return new Sqrt();
+    case 10: return new Cube();
+    case 11: return new Sin();
+    case 12: return new Cos();
+    case 13: return new Log();
+    default: throw runtime_error("Unrecognized opcode in program: "+to_string(opcode));
+  }
+}
+
+template<typename T>
+void _append_bytes(string & bytes, T value) {
+  bytes.append((char*) &value, sizeof(T));
+}
+
+template<typename T>
+T _read_bytes(const string & bytes, size_t & pos) {
+  if (pos + sizeof(T) > bytes.size())
+    throw runtime_error("Truncated program");
+  T value;
+  memcpy(&value, bytes.data() + pos, sizeof(T));
+  pos += sizeof(T);
+  return value;
+}
+
+inline void _serialize_op(Op * op, string & code, int & max_feat) {
+  if (op->type() == OpType::otFeat) {
+    int id = ((Feat*)op)->id;
+    max_feat = max(max_feat, id);
+    _append_bytes<uint8_t>(code, OPCODE_FEAT);
+    _append_bytes<int32_t>(code, id);
+  } else if (op->type() == OpType::otConst) {
+    Const * k = (Const*) op;
+    if (isnan(k->c))
+      k->_sample();
+    _append_bytes<uint8_t>(code, OPCODE_CONST);
+    _append_bytes<float>(code, k->c);
+  } else {
+    string sym = op->sym();
+    auto it = find(program_symbols.begin() + 2, program_symbols.end(), sym);
+    if (it == program_symbols.end())
+      throw runtime_error("Operator cannot be serialized: "+sym);
+    _append_bytes<uint8_t>(code, (uint8_t) (it - program_symbols.begin()));
+  }
+}
+
+inline Op * _deserialize_op(const string & bytes, size_t & pos) {
+  uint8_t opcode = _read_bytes<uint8_t>(bytes, pos);
+  if (opcode == OPCODE_FEAT)
+    return new Feat(_read_bytes<int32_t>(bytes, pos));
+  if (opcode == OPCODE_CONST)
+    return new Const(_read_bytes<float>(bytes, pos));
+  return _new_function_op(opcode);
+}
+
+inline void _serialize_recursive(Node * n, string & code, uint32_t & num_instructions, int & max_feat) {
+  Op * op = n->op;
+  for(int i = 0; i < op->arity(); i++)
+    _serialize_recursive(n->children[i], code, num_instructions, max_feat);
+
+  num_instructions++;
+  _serialize_op(op, code, max_feat);
+}
+
+inline string serialize_program(Node * tree) {
+  string code;
+  uint32_t num_instructions = 0;
+  int max_feat = -1;
+  _serialize_recursive(tree, code, num_instructions, max_feat);
+
+  string bytes(PROGRAM_MAGIC, 4);
+  _append_bytes<uint8_t>(bytes, PROGRAM_VERSION);
+  _append_bytes<uint32_t>(bytes, max_feat + 1);
+  _append_bytes<uint32_t>(bytes, num_instructions);
+  bytes += code;
+  return bytes;
+}
+
+// Rebuilds the (intron-free) tree of a program; num_features is set to the number of columns the program needs
+inline Node * deserialize_program(const string & bytes, int * num_features=NULL) {
+  if (bytes.size() < 4 || memcmp(bytes.data(), PROGRAM_MAGIC, 4) != 0)
+    throw runtime_error("Not a program");
+  size_t pos = 4;
+  uint8_t version = _read_bytes<uint8_t>(bytes, pos);
+  if (version > PROGRAM_VERSION)
+    throw runtime_error("Unsupported program version: "+to_string(version));
+  uint32_t needed_features = _read_bytes<uint32_t>(bytes, pos);
+  uint32_t num_instructions = _read_bytes<uint32_t>(bytes, pos);
+  if (num_features)
+    *num_features = needed_features;
+
+  vector<Node*> stack;
+  auto clear_stack = [&]() {
+    for(Node * n : stack)
+      n->clear();
+  };
+  for(uint32_t i = 0; i < num_instructions; i++) {
+    Op * op;
+    try {
+      op = _deserialize_op(bytes, pos);
+    } catch (runtime_error & e) {
+      clear_stack();
+      throw;
+    }
+
+    Node * n = new Node(op);
+    int a = op->arity();
+    // a feature outside of the columns of the header would be read out of bounds by predict_batch
+    int64_t feat = op->type() == OpType::otFeat ? ((Feat*)op)->id : 0;
+    bool bad_feat = feat < 0 || (op->type() == OpType::otFeat && feat >= needed_features);
+    if (stack.size() < a || bad_feat) {
+      n->clear();
+      clear_stack();
+      throw runtime_error("Malformed program");
+    }
+    for(int j = stack.size() - a; j < stack.size(); j++)
+      n->append(stack[j]);
+    stack.resize(stack.size() - a);
+    stack.push_back(n);
+  }
+
+  if (stack.size() != 1 || pos != bytes.size()) {
+    clear_stack();
+    throw runtime_error("Malformed program");
+  }
+  return stack[0];
+}
+
+inline void _serialize_genotype_recursive(Node * n, string & code, uint32_t & num_nodes) {
+  int max_feat = -1;
+  num_nodes++;
+  _serialize_op(n->op, code, max_feat);
+  _append_bytes<uint8_t>(code, (uint8_t) n->children.size());
+  for(Node * c : n->children)
+    _serialize_genotype_recursive(c, code, num_nodes);
+}
+
+inline string serialize_genotype(Node * tree) {
+  string code;
+  uint32_t num_nodes = 0;
+  _serialize_genotype_recursive(tree, code, num_nodes);
+
+  string bytes(GENOTYPE_MAGIC, 4);
+  _append_bytes<uint8_t>(bytes, GENOTYPE_VERSION);
+  _append_bytes<uint32_t>(bytes, num_nodes);
+  bytes += code;
+  return bytes;
+}
+
+inline Node * _deserialize_genotype_recursive(const string & bytes, size_t & pos, uint32_t & remaining) {
+  if (remaining == 0)
+    throw runtime_error("Malformed genotype");
+  remaining--;
+  Node * n = new Node(_deserialize_op(bytes, pos));
+  try {
+    uint8_t num_children = _read_bytes<uint8_t>(bytes, pos);
+    for(int i = 0; i < num_children; i++)
+      n->append(_deserialize_genotype_recursive(bytes, pos, remaining));
+  } catch (runtime_error & e) {
+    n->clear();
+    throw;
+  }
+  return n;
+}
+
+// Rebuilds the full tree (introns included) of a genotype
+inline Node * deserialize_genotype(const string & bytes) {
+  if (bytes.size() < 4 || memcmp(bytes.data(), GENOTYPE_MAGIC, 4) != 0)
+    throw runtime_error("Not a genotype");
+  size_t pos = 4;
+  uint8_t version = _read_bytes<uint8_t>(bytes, pos);
+  if (version > GENOTYPE_VERSION)
+    throw runtime_error("Unsupported genotype version: "+to_string(version));
+  uint32_t num_nodes = _read_bytes<uint32_t>(bytes, pos);
+  Node * tree = _deserialize_genotype_recursive(bytes, pos, num_nodes);
+  if (num_nodes != 0 || pos != bytes.size()) {
+    tree->clear();
+    throw runtime_error("Malformed genotype");
+  }
+  return tree;
+}
+
+// Evaluates the tree over row blocks of X, in parallel over blocks (with its compiled kernel, if JIT is on)
+inline Vec predict_batch(Node * tree, Mat & X, int num_threads=1, int block_size=4096) {
+  int n = X.rows();
+  Vec out(n);
+  int num_blocks = (n + block_size - 1) / block_size;
+  jit::Kernel k = jit::enabled && jit::_readable() ? jit::kernel(tree, true) : NULL;
+  if (k) {
+    // blocks are read in place, the kernel takes the stride of the columns
+    parallel_for(num_blocks, num_threads, [&](int b) {
+      int start = b * block_size;
+      k(X.data() + start, min(block_size, n - start), X.rows(), out.data() + start);
+    });
+    return out;
+  }
+  if (num_blocks <= 1) {
+    out = tree->get_output(X);
+    return out;
+  }
+  parallel_for(num_blocks, num_threads, [&](int b) {
+    int start = b * block_size;
+    int len = min(block_size, n - start);
+    out.segment(start, len) = tree->get_output(X.middleRows(start, len)); // (a view, not a copy)
+  });
+  return out;
+}
+
+inline Vec predict_batch(const string & program, Mat & X, int num_threads=1, int block_size=4096) {
+  int num_features;
+  Node * tree = deserialize_program(program, &num_features);
+  if (X.cols() < num_features) {
+    tree->clear();
+    throw runtime_error("The program needs "+to_string(num_features)+" features, got "+to_string(X.cols()));
+  }
+  Vec out = predict_batch(tree, X, num_threads, block_size);
+  tree->clear();
+  return out;
+}
+
+#endif
@@ -30,7 +30,7 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
     s = ""
     for k in kwargs:
       # skip python-only params
-      if k in ["finetune", "model", "finetune_max_evals"]:
+      if k in ["finetune", "model", "program", "profile_records", "finetune_max_evals"]:
         continue
 
       # handle bool flags for c++ 
@@ -52,7 +52,7 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
     attributes = inspect.getmembers(self, lambda a:not(inspect.isroutine(a)))
     attributes = [x for x in attributes if not 
       ((x[0].startswith("__") and x[0].endswith("__")) or 
-      x[0] in ["_estimator_type"])]
+      x[0] in ["_estimator_type", "_session"])]
 
     dic = {}
     for a in attributes:
@@ -66,11 +66,14 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
 
     return self
 
+  def __getstate__(self):
+    # the C++ session cannot be pickled
+    state = self.__dict__.copy()
+    state.pop("_session", None)
+    return state
 
-  def fit(self, X, y):
-    # setup cpp interface
-    cpp_options = self._create_cpp_option_string()
-    
+
+  def _prepare_data(self, X, y, fit_imputer):
     # conver to numpy if it is a pandas dataframe
     if isinstance(X, pd.DataFrame):
       X = X.values
@@ -80,14 +83,53 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
     
     # impute if needed
     if np.isnan(X).any():
-      self.imputer, X = imputing.fit_and_apply_imputation(X)
+      if fit_imputer or not hasattr(self, "imputer"):
+        self.imputer, X = imputing.fit_and_apply_imputation(X)
+      else:
+        X = self.imputer.transform(X)
       # fix non-contiguous memory block for SWIG
       X = X.copy()
 
-    models = _pb_gpg.evolve(cpp_options, X, y)
+    return X, y
+
+
+  def fit(self, X, y):
+    # setup cpp interface
+    cpp_options = self._create_cpp_option_string()
+    
+    X, y = self._prepare_data(X, y, fit_imputer=True)
+
+    # the session keeps the search state alive for `continue_fit`
+    self._session = _pb_gpg.GPGSession(cpp_options)
+    models = self._session.fit(X, y)
+    self._store_profile()
 
     # extract the model as a sympy and store it internally
-    self.model = self._pick_best_model(X, y, models)
+    self.model = self._pick_best_model(X, y, models, self._session.programs())
+    return self
+
+
+  def continue_fit(self, X, y, budget=1.0):
+    """
+    Refits on (updated) data with the same features, starting from the populations and 
+    elites of the previous fit, using `budget` times the configured budget
+    """
+    if not hasattr(self, "_session"):
+      return self.fit(X, y)
+
+    X, y = self._prepare_data(X, y, fit_imputer=False)
+
+    models = self._session.continue_fit(X, y, budget)
+    self._store_profile()
+
+    self.model = self._pick_best_model(X, y, models, self._session.programs())
+    return self
+
+
+  def _store_profile(self):
+    # per-phase timers & counters (list of dicts), if profiling was requested
+    if getattr(self, "profile", False) or getattr(self, "profile_out", ""):
+      self.profile_records = self._session.profile()
 
 
   def _finetune_multiple_models(self, models, X, y):
@@ -123,7 +165,7 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
             finetune_num_steps[np.random.randint(i+1, len(models))] += 1
     
 
-  def _pick_best_model(self, X, y, models):
+  def _pick_best_model(self, X, y, models, programs=None):
     
     
     
@@ -141,6 +183,8 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
 
     # cleanup
     models = [conversion.model_cleanup(m, timeout=5) for m in models]
+    if programs is not None:
+      programs = [p for m, p in zip(models, programs) if m is not None]
     models = [m for m in models if m is not None]
 
     # finetune  
@@ -169,17 +213,32 @@ class GPGRegressor(BaseEstimator, RegressorMixin):
       best_idx = complexity.determine_rci_best(errs, compls, self.rci)
     else:
       best_idx = np.argmin(errs)
+
+    # keep the native program of the best model, unless finetuning changed it
+    # or it does not reproduce the predictions of the sympy model
+    self.program = None
+    if programs is not None and not (hasattr(self, "finetune") and self.finetune):
+      p_native = _pb_gpg.predict_batch(programs[best_idx], X)
+      p_sympy = self.predict(X, model=models[best_idx])
+      if np.allclose(p_native, p_sympy, rtol=1e-3, atol=1e-3):
+        self.program = programs[best_idx]
     
     return models[best_idx]
 
     
   def predict(self, X, model=None):
+    if isinstance(X, pd.DataFrame):
+      X = X.values
+
     if model is None:
+      # use the native program of the best model if available (no sympy conversion)
+      if getattr(self, "program", None) is not None:
+        if np.isnan(X).any():
+          assert(hasattr(self, "imputer"))
+          X = self.imputer.transform(X)
+        return np.asarray(_pb_gpg.predict_batch(self.program, X), dtype=float)
       # assume implicitly wanted the best one found at fit
       model = self.model
-      
-    if isinstance(X, pd.DataFrame):
-      X = X.values
 
     # deal with a model that was simplified to a simple constant
     if type(model) == sympy.Float or type(model) == sympy.Integer:
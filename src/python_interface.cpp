@@ -1,61 +1,122 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen.h>
+#include <pybind11/stl.h>
 #include <iostream>
 
 #include "util.hpp"
 #include "myeig.hpp"
 #include "globals.hpp"
 #include "ims.hpp"
+#include "session.hpp"
+#include "program.hpp"
 
 namespace py = pybind11; 
 using namespace std;
 
-py::list evolve(string options, myeig::Mat &X, myeig::Vec &y) {
-  // 1. SETUP
-  auto opts = split_string(options, " ");
-  int argc = opts.size()+1;
-  char * argv[argc];
-  string title = "gpg";
-  argv[0] = (char*) title.c_str();
-  for (int i = 1; i < argc; i++) {
-    argv[i] = (char*) opts[i-1].c_str();
-  }
-  g::read_options(argc, argv);
-
-  // initialize evolution handler 
-  IMS * ims = new IMS();
-
-  // set training set
-  g::fit_func->set_Xy(X, y);
-  // set terminals
-  g::set_terminals(g::lib_tset);
-  g::apply_feature_selection(g::lib_feat_sel_number);
-  g::set_terminal_probabilities(g::lib_tset_probs);
-  print("terminal set: ",g::str_terminal_set()," (probs: ",g::lib_tset_probs,")");
-  // set batch size
-  g::set_batch_size(g::lib_batch_size);
-  print("batch size: ", g::batch_size);
-
-  // 2. RUN
-  ims->run();
-
-  // 3. OUTPUT
-  if (ims->elites_per_complexity.empty()) {
-    throw runtime_error("Not models found, something went wrong");
-  }
-  py::list models;
-  for (auto it = ims->elites_per_complexity.begin(); it != ims->elites_per_complexity.end(); it++) {
-    string model_repr = it->second->human_repr();
-    models.append(model_repr);
+py::list _to_py_list(vector<string> models) {
+  py::list result;
+  for (string & m : models) {
+    result.append(m);
   }
+  return result;
+}
 
-  // 4. CLEANUP
-  delete ims;
+// The search stops at the next generation on CTRL+C, which is then raised as KeyboardInterrupt
+void _raise_if_interrupted() {
+  if (PyErr_Occurred())
+    throw py::error_already_set();
+}
 
-  return models;
+py::list evolve(string options, myeig::Mat &X, myeig::Vec &y) {
+  Session session(options);
+  session.fit(X, y);
+  _raise_if_interrupted();
+  return _to_py_list(session.models());
+}
+
+py::list _to_py_bytes_list(vector<string> programs) {
+  py::list result;
+  for (string & p : programs) {
+    result.append(py::bytes(p));
+  }
+  return result;
+}
+
+py::list _to_py_profile(vector<prof::Record> records) {
+  py::list result;
+  for (prof::Record & r : records) {
+    py::dict seconds, calls;
+    for (int p = 0; p < prof::NUM_PHASES; p++) {
+      seconds[prof::phase_names[p]] = r.seconds[p];
+      calls[prof::phase_names[p]] = r.calls[p];
+    }
+    py::dict d;
+    d["macro_generation"] = r.macro_generation;
+    d["evolution"] = r.evolution;
+    d["pop_size"] = r.pop_size;
+    d["wall_seconds"] = r.wall_seconds;
+    d["evaluations"] = r.evaluations;
+    d["node_evaluations"] = r.node_evaluations;
+    d["mi_pairs"] = r.mi_pairs;
+    d["seconds"] = seconds;
+    d["calls"] = calls;
+    if (hw::enabled) {
+      py::dict counts, per_node_evaluation, per_mi_pair;
+      for (int p = 0; p < prof::NUM_PHASES; p++) {
+        py::dict phase_counts;
+        for (int c = 0; c < hw::NUM_COUNTERS; c++)
+          phase_counts[hw::counter_names[c]] = r.hw[p][c];
+        counts[prof::phase_names[p]] = phase_counts;
+      }
+      for (int c = 0; c < hw::NUM_COUNTERS; c++) {
+        per_node_evaluation[hw::counter_names[c]] = r.hw_per(prof::phEvaluation, c, r.node_evaluations);
+        per_mi_pair[hw::counter_names[c]] = r.hw_per(prof::phMI, c, r.mi_pairs);
+      }
+      d["hw"] = counts;
+      d["hw_per_node_evaluation"] = per_node_evaluation;
+      d["hw_per_mi_pair"] = per_mi_pair;
+    }
+    result.append(d);
+  }
+  return result;
 }
 
 PYBIND11_MODULE(_pb_gpg, m) {
   m.doc() = "pybind11-based interface for gpg"; // optional module docstring
+  g::interrupt_check = []() { return PyErr_CheckSignals() == -1; };
   m.def("evolve", &evolve, "Runs gpg evolution in C++");
-}
\ No newline at end of file
+
+  py::class_<Session>(m, "GPGSession", "Keeps the configuration and the state of the search alive across fits")
+    .def(py::init<string>(), py::arg("options"))
+    .def("fit", [](Session & s, myeig::Mat & X, myeig::Vec & y) {
+      s.fit(X, y);
+      _raise_if_interrupted();
+      return _to_py_list(s.models());
+    }, "Runs the search from scratch, returns the models found", py::arg("X"), py::arg("y"))
+    .def("continue_fit", [](Session & s, myeig::Mat & X, myeig::Vec & y, float budget) {
+      s.continue_fit(X, y, budget);
+      _raise_if_interrupted();
+      return _to_py_list(s.models());
+    }, "Resumes the search on new data (same features) for a fraction of the configured budget, returns the models found", 
+      py::arg("X"), py::arg("y"), py::arg("budget")=1.0)
+    .def("models", [](Session & s) {
+      return _to_py_list(s.models());
+    }, "Returns the models found by the last (continued) fit")
+    .def("profile", [](Session & s) {
+      return _to_py_profile(s.profile());
+    }, "Returns the profiling records of the last (continued) fit (per evolution, and per macro generation with evolution -1), empty unless `-profile` or `-profile_out` is set")
+    .def("programs", [](Session & s) {
+      return _to_py_bytes_list(s.programs());
+    }, "Returns the models found by the last (continued) fit as serialised programs, in the same order as `models`");
+
+  m.def("predict_batch", [](const string & program, myeig::Mat & X, int num_threads) {
+      return predict_batch(program, X, num_threads);
+    }, "Evaluates a serialised program on the rows of X (the GIL is released)", 
+    py::arg("program"), py::arg("X"), py::arg("num_threads")=1, py::call_guard<py::gil_scoped_release>());
+  m.def("program_repr", [](const string & program) {
+      Node * tree = deserialize_program(program);
+      string repr = tree->human_repr();
+      tree->clear();
+      return repr;
+    }, "Returns the human-readable representation of a serialised program", py::arg("program"));
+}
@@ -9,6 +9,8 @@
 #include "util.hpp"
 #include <mutex>
 #include <random>
+#include <numeric>
+#include <cmath>
 
 /**
  * Rationale for doing it this way:
@@ -17,10 +19,18 @@
  * - Xoshiro (https://prng.di.unimi.it/) fits the bill according to
  *   my understanding
  * - To allow thread safety and still have determinism irrespective of
- *   execution order, the same seed is used on all threads
+ *   execution order, all threads derive their stream from the same seed:
+ *   `set_stream(worker, key)` places the calling thread on the stream of
+ *   `worker` (the base stream advanced by `worker` long jumps, i.e., 2^192
+ *   steps, so workers never overlap), optionally offset by a `key` (e.g.,
+ *   the index of an individual) so that results do not depend on which
+ *   worker processes what
  * - To be able to use the same seed everywhere, it must be a global
  * - To have thread safety and performance, each thread has it's own
  *   thread_local rng
+ * - Bulk generation (`fill_randu`, `fill_randn`) steps several
+ *   independent lanes (each a jump, i.e., 2^128 steps, apart) at once, so
+ *   that the state update can be vectorized
  *
  * !!! Important !!!
  * C++ assignment/copy construction is a pain, so always call
@@ -42,8 +52,65 @@ private:
   inline static uint64_t seed = 0;
   Rng(){};
 
-  inline static uniform_real_distribution<double> unif_distr = uniform_real_distribution<double>(0.0, 1.0);
-  inline static normal_distribution<double> norm_distr = normal_distribution<double>(0.0, 1.0);
+  // Lanes of the bulk generator, kept as separate arrays per state word for vectorization
+  struct BulkState {
+    static const int LANES = 8;
+    bool initialized = false;
+    uint64_t s0[LANES], s1[LANES], s2[LANES], s3[LANES];
+    uint64_t out[LANES];
+
+    void init(Xoshiro::Xoshiro256PP & rng) {
+      // lane l starts (l+1) jumps ahead of the thread rng
+      Xoshiro::Xoshiro256PP lane_rng = rng;
+      for(int l = 0; l < LANES; l++) {
+        lane_rng = lane_rng.jump();
+        s0[l] = lane_rng.state[0];
+        s1[l] = lane_rng.state[1];
+        s2[l] = lane_rng.state[2];
+        s3[l] = lane_rng.state[3];
+      }
+      initialized = true;
+    }
+
+    void next() {
+      for(int l = 0; l < LANES; l++) {
+        out[l] = Xoshiro::rotl64(s0[l] + s3[l], 23) + s0[l];
+        uint64_t t = s1[l] << 17;
+        s2[l] ^= s0[l];
+        s3[l] ^= s1[l];
+        s1[l] ^= s2[l];
+        s0[l] ^= s3[l];
+        s2[l] ^= t;
+        s3[l] = Xoshiro::rotl64(s3[l], 45);
+      }
+    }
+  };
+
+  static BulkState& bulk_state()
+  {
+    thread_local static BulkState bulk;
+    return bulk;
+  }
+
+  static BulkState& get_bulk()
+  {
+    BulkState & bulk = bulk_state();
+    if (!bulk.initialized)
+      bulk.init(Rng::get());
+    return bulk;
+  }
+
+  static uniform_real_distribution<double>& unif_distr()
+  {
+    thread_local static uniform_real_distribution<double> d(0.0, 1.0);
+    return d;
+  }
+
+  static normal_distribution<double>& norm_distr()
+  {
+    thread_local static normal_distribution<double> d(0.0, 1.0);
+    return d;
+  }
 
 public:
   // Prevent auto generation of copy constructor and assignment operator (because we want a singleton)
@@ -79,10 +146,47 @@ public:
     return instance;
   };
 
+  // Places the calling thread on the stream of `worker` (long jumps from the seed), 
+  // offset by `key` if non-zero (e.g., to have a reproducible stream per individual)
+  static void set_stream(int worker, uint64_t key=0)
+  {
+    thread_local static int cached_worker = -1;
+    thread_local static uint64_t cached_seed = 0;
+    thread_local static Xoshiro::Xoshiro256PP worker_rng;
+    uint64_t curr_seed = Rng::get_seed();
+    if (worker != cached_worker || curr_seed != cached_seed) {
+      worker_rng = Xoshiro::Xoshiro256PP(curr_seed);
+      for(int i = 0; i < worker; i++)
+        worker_rng = worker_rng.long_jump();
+      cached_worker = worker;
+      cached_seed = curr_seed;
+    }
+    Xoshiro::Xoshiro256PP & rng = Rng::get();
+    rng = worker_rng;
+    if (key != 0) {
+      // a pseudo-random offset along the period of the stream
+      for(int i = 0; i < 4; i++)
+        rng.state[i] ^= Xoshiro::splitmix64(key + i);
+    }
+    // reset what depends on the thread rng
+    unif_distr().reset();
+    norm_distr().reset();
+    bulk_state().initialized = false;
+  }
+
+  // Puts back a state of the thread rng saved with `Rng::get()` (e.g., after `set_stream`)
+  static void restore(const Xoshiro::Xoshiro256PP & state)
+  {
+    Rng::get() = state;
+    unif_distr().reset();
+    norm_distr().reset();
+    bulk_state().initialized = false;
+  }
+
   // Returns a random number in the range [0,1)
   static double randu()
   {
-    return unif_distr(Rng::get());
+    return unif_distr()(Rng::get());
   };
 
   static int randi(int min_inclusive, int max_exclusive) {
@@ -98,18 +202,58 @@ public:
   // Returns a random number from the normal distribution
   static double randn(double mean=0.0, double stdev=1.0)
   {
-    return norm_distr(Rng::get())*stdev + mean;
+    return norm_distr()(Rng::get())*stdev + mean;
   };
 
+  // Fills data with n random numbers in the range [0,1), using the bulk generator
+  static void fill_randu(float * data, int n)
+  {
+    BulkState & bulk = get_bulk();
+    const int L = BulkState::LANES;
+    for(int i = 0; i < n; i += L) {
+      bulk.next();
+      int m = min(L, n - i);
+      for(int l = 0; l < m; l++)
+        data[i + l] = (bulk.out[l] >> 40) * 0x1.0p-24f; // 24 random bits of mantissa
+    }
+  }
+
+  // Fills data with n random numbers from the normal distribution (Box-Muller), using the bulk generator
+  static void fill_randn(float * data, int n, float mean=0.0, float stdev=1.0)
+  {
+    int half = (n + 1) / 2;
+    Vec u1(half), u2(half);
+    fill_randu(u1.data(), half);
+    fill_randu(u2.data(), half);
+    u1 = 1.0f - u1; // in (0,1], for the log
+    Vec r = (-2.0f * u1.log()).sqrt();
+    Vec theta = 2.0f * (float) M_PI * u2;
+    Vec z(2 * half);
+    z.head(half) = r * theta.cos();
+    z.tail(half) = r * theta.sin();
+    for(int i = 0; i < n; i++)
+      data[i] = z[i]*stdev + mean;
+  }
+
+  static Vec randu_vec(int n)
+  {
+    Vec v(n);
+    fill_randu(v.data(), n);
+    return v;
+  }
+
+  static Vec randn_vec(int n, float mean=0.0, float stdev=1.0)
+  {
+    Vec v(n);
+    fill_randn(v.data(), n, mean, stdev);
+    return v;
+  }
+
   // Returns a matrix unitialized with the random uniform distribution (values between 0 incl. and 1 excl.)
   static Mat randu_mat(int n_rows, int n_cols)
   {
     Mat m = Mat(n_rows, n_cols);
-    for(int i = 0; i < n_rows; i++) {
-      for(int j = 0; j < n_cols; j++) {
-        m(i, j) = randu();
-      }
-    }
+    fill_randu(m.data(), m.size());
     return m;
   }
 
@@ -117,22 +261,25 @@ public:
   static Mat randn_mat(int n_rows, int n_cols, double mean=0.0, double stdev=1.0)
   {
     Mat m = Mat(n_rows, n_cols);
-    for(int i = 0; i < n_rows; i++) {
-      for(int j = 0; j < n_cols; j++) {
-        m(i, j) = randn(mean, stdev);
-      }
-    }
+    fill_randn(m.data(), m.size(), mean, stdev);
     return m;
   }
 
+  // Writes a random permutation of the numbers 0 to num_elements-1 into perm (Fisher-Yates, O(n))
+  static void rand_perm(int num_elements, vector<int> & perm) {
+    perm.resize(num_elements);
+    iota(perm.begin(), perm.end(), 0);
+    for(int i = num_elements - 1; i > 0; i--) {
+      int j = randi(i + 1);
+      swap(perm[i], perm[j]);
+    }
+  }
+
   // Returns a random permutation of the numbers 0 to num_elements-1
   static vector<int> rand_perm(int num_elements) {
-    vector<double> rand_vec;
-    rand_vec.reserve(num_elements);
-    for(int i = 0; i < num_elements; i++) {
-      rand_vec.push_back(Rng::randu());
-    }
-    return argsort(rand_vec);
+    vector<int> perm;
+    rand_perm(num_elements, perm);
+    return perm;
   }
 
 };
@@ -0,0 +1,233 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "tracing.hpp"
+#include "numa.hpp"
+
+using namespace std;
+
+/*
+  Work-stealing scheduler behind `parallel_for` (see util.hpp), shared by all the parallel loops:
+  GOM of the individuals of a generation, MI of the rows of the linkage matrix, row blocks of
+  batch predictions, complexities of the candidates to the elite archive, feature selection.
+  The threads are created once and sleep between loops, so that they are reused across
+  generations. A loop over [0, n) is cut into chunks of `grain` iterations, which are dealt out as
+  contiguous runs to the deques of the participating threads (the calling thread takes part as
+  worker 0). Each thread pops chunks from the front of its own deque and, once that is empty,
+  steals from the back of the others, so that threads that got cheap iterations (e.g., small
+  individuals, short rows of the MI matrix) help those that got expensive ones.
+  With `-numa`, threads are pinned to NUMA nodes when they join a loop, the calling thread only for
+  the duration of the loop (see numa.hpp).
+  Loops started from within a loop, or while another thread is running one, run serially on the
+  calling thread. The first exception thrown by an iteration is rethrown by `parallel_for`.
+*/
+
+namespace sched {
+
+  struct Chunk {
+    int begin, end;
+  };
+
+  struct Deque {
+    mutex m;
+    deque<Chunk> chunks;
+
+    // the owner takes from the front
+    bool pop(Chunk & c) {
+      lock_guard<mutex> lock(m);
+      if (chunks.empty())
+        return false;
+      c = chunks.front();
+      chunks.pop_front();
+      return true;
+    }
+
+    // thieves take from the back
+    bool steal(Chunk & c) {
+      lock_guard<mutex> lock(m);
+      if (chunks.empty())
+        return false;
+      c = chunks.back();
+      chunks.pop_back();
+      return true;
+    }
+  };
+
+  struct Job {
+    void (*run)(void * ctx, int begin, int end);
+    void * ctx;
+    int num_workers;
+    mutex error_mutex;
+    exception_ptr error;
+  };
+
+  // Index of the worker running the calling thread's current iteration (0 outside of loops)
+  inline int & _worker_id() {
+    thread_local int id = 0;
+    return id;
+  }
+
+  inline bool & _in_loop() {
+    thread_local bool in_loop = false;
+    return in_loop;
+  }
+
+  inline int worker_id() {
+    return _worker_id();
+  }
+
+  struct Pool {
+    vector<thread> threads; // worker w > 0 runs on threads[w-1]
+    vector<unique_ptr<Deque>> deques; // one per worker
+    mutex m;
+    condition_variable wake, done;
+    uint64_t epoch = 0; // incremented for each loop
+    bool stopping = false;
+    Job * job = NULL;
+    atomic<int> num_busy{0}; // pool threads that did not finish the current loop yet
+    mutex loop_mutex; // one loop at a time
+
+    ~Pool() {
+      {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (thread & t : threads)
+        t.join();
+    }
+
+    // Grows the pool to (at least) num_workers, the caller included
+    void ensure(int num_workers) {
+      while (deques.size() < num_workers)
+        deques.push_back(make_unique<Deque>());
+      while (threads.size() + 1 < num_workers) {
+        int w = threads.size() + 1;
+        uint64_t seen;
+        {
+          lock_guard<mutex> lock(m);
+          seen = epoch;
+        }
+        threads.emplace_back([this, w, seen]() { _thread_loop(w, seen); });
+      }
+    }
+
+    void _thread_loop(int w, uint64_t seen) {
+      _worker_id() = w;
+      _in_loop() = true;
+      while (true) {
+        Job * j;
+        {
+          unique_lock<mutex> lock(m);
+          wake.wait(lock, [&]() { return stopping || epoch != seen; });
+          if (stopping)
+            return;
+          seen = epoch;
+          j = job;
+        }
+        if (w < j->num_workers) {
+          numa::place_thread(w);
+          _work(j, w);
+        }
+        if (trace::enabled)
+          trace::flush_thread();
+        if (num_busy.fetch_sub(1, memory_order_acq_rel) == 1) {
+          lock_guard<mutex> lock(m);
+          done.notify_all();
+        }
+      }
+    }
+
+    void _work(Job * j, int w) {
+      Chunk c;
+      while (true) {
+        if (!deques[w]->pop(c)) {
+          bool stolen = false;
+          for (int k = 1; k < j->num_workers && !stolen; k++)
+            stolen = deques[(w + k) % j->num_workers]->steal(c);
+          if (!stolen)
+            return;
+        }
+        try {
+          j->run(j->ctx, c.begin, c.end);
+        } catch (...) {
+          lock_guard<mutex> lock(j->error_mutex);
+          if (!j->error)
+            j->error = current_exception();
+        }
+      }
+    }
+
+    // Runs the job on num_workers workers (the caller being worker 0); loop_mutex must be held
+    void run(Job & j, int n, int grain) {
+      ensure(j.num_workers);
+      int num_chunks = (n + grain - 1) / grain;
+      for (int k = 0; k < num_chunks; k++) {
+        int w = (long long) k * j.num_workers / num_chunks;
+        deques[w]->chunks.push_back(Chunk{k * grain, min(n, (k + 1) * grain)});
+      }
+      {
+        lock_guard<mutex> lock(m);
+        job = &j;
+        num_busy = threads.size();
+        epoch++;
+      }
+      wake.notify_all();
+
+      numa::CallerPlacement placement;
+      _in_loop() = true;
+      _work(&j, 0);
+      _in_loop() = false;
+
+      unique_lock<mutex> lock(m);
+      done.wait(lock, [&]() { return num_busy.load(memory_order_acquire) == 0; });
+      job = NULL;
+    }
+  };
+
+  inline Pool & pool() {
+    static Pool p;
+    return p;
+  }
+
+  // Calls f(i) for i in [0, n) on up to num_threads threads, handing out chunks of grain iterations
+  template<typename F>
+  void parallel_for(int n, int num_threads, F && f, int grain=1) {
+    grain = max(1, grain);
+    int num_workers = min(num_threads, (n + grain - 1) / grain);
+    Pool & p = pool();
+    if (num_workers <= 1 || _in_loop() || !p.loop_mutex.try_lock()) {
+      for (int i = 0; i < n; i++)
+        f(i);
+      return;
+    }
+    lock_guard<mutex> lock(p.loop_mutex, adopt_lock);
+
+    typedef typename remove_reference<F>::type Fn;
+    Job j;
+    j.run = [](void * ctx, int begin, int end) {
+      Fn & f = *(Fn*) ctx;
+      for (int i = begin; i < end; i++)
+        f(i);
+    };
+    j.ctx = (void*) &f;
+    j.num_workers = num_workers;
+    p.run(j, n, grain);
+    if (j.error)
+      rethrow_exception(j.error);
+  }
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SELECTION_H
 
 #include <vector>
+#include <numeric>
 #include "node.hpp"
 #include "util.hpp"
 #include "globals.hpp"
@@ -9,50 +10,100 @@
 
 using namespace std;
 
-Node * tournament(vector<Node*> & candidates, int tournament_size) {
-  auto rp = Rng::rand_perm(candidates.size());
-  Node * winner = candidates[rp[0]];
+inline vector<int> & _sample_buffer() {
+  thread_local static vector<int> buffer;
+  return buffer;
+}
+
+// Draws k distinct indices in [0, n) with a partial Fisher-Yates shuffle, in O(k).
+// The result is in the first k entries of the returned (thread-local, reused) buffer.
+// The buffer is not reset between calls since any permutation is a valid starting point
+inline vector<int> & sample_indices(int n, int k) {
+  vector<int> & buffer = _sample_buffer();
+  if (buffer.size() != n) {
+    buffer.resize(n);
+    iota(buffer.begin(), buffer.end(), 0);
+  }
+  assert(k <= n);
+  for(int i = 0; i < k; i++) {
+    int j = Rng::randi(i, n);
+    swap(buffer[i], buffer[j]);
+  }
+  return buffer;
+}
+
+// Resets the buffer of sample_indices, so that what is drawn next depends only on the rng (e.g., after `Rng::set_stream`)
+inline void reset_sample_indices() {
+  _sample_buffer().clear();
+}
+
+// Returns the winner of the tournament (not a copy, clone it if needed)
+inline Node * tournament(vector<Node*> & candidates, int tournament_size) {
+  auto & idx = sample_indices(candidates.size(), tournament_size);
+  Node * winner = candidates[idx[0]];
   for(int i = 1; i < tournament_size; i++) {
-    if (candidates[rp[i]]->fitness <= winner->fitness)
-      winner = candidates[rp[i]];
+    if (candidates[idx[i]]->fitness <= winner->fitness)
+      winner = candidates[idx[i]];
   }
-  return winner->clone();
+  return winner;
 }
 
-vector<Node*> popwise_tournament(vector<Node*> & population, int selection_size, int tournament_size, bool stochastic=false) {
+// If take_ownership is true, winners are moved out of the population the first time they are 
+// selected (leaving NULL in their place) and cloned only if they are selected again
+inline vector<Node*> popwise_tournament(vector<Node*> & population, int selection_size, int tournament_size, bool stochastic=false, bool take_ownership=false) {
   int pop_size = population.size();
   vector<Node*> selected; selected.reserve(selection_size);
+  vector<bool> taken(take_ownership ? pop_size : 0, false);
+
+  auto select = [&](int winner_idx) {
+    if (take_ownership && !taken[winner_idx]) {
+      taken[winner_idx] = true;
+      selected.push_back(population[winner_idx]);
+    } else {
+      selected.push_back(population[winner_idx]->clone());
+    }
+  };
   
   if (stochastic) {
     while(selected.size() < selection_size) {
-      selected.push_back(tournament(population, tournament_size));
+      auto & idx = sample_indices(pop_size, tournament_size);
+      int winner_idx = idx[0];
+      for(int i = 1; i < tournament_size; i++) {
+        if (population[idx[i]]->fitness <= population[winner_idx]->fitness)
+          winner_idx = idx[i];
+      }
+      select(winner_idx);
     }
-  }
-  
-  // else proceed with deterministic
-
-  assert(  ((float)pop_size) / tournament_size == (float) pop_size / tournament_size );
+  } else {
+    assert(  ((float)pop_size) / tournament_size == (float) pop_size / tournament_size );
 
-  int n_selected_per_round = pop_size / tournament_size;
-  int n_rounds = selection_size / n_selected_per_round;
+    int n_selected_per_round = pop_size / tournament_size;
+    int n_rounds = selection_size / n_selected_per_round;
 
-  for(int i = 0; i < n_rounds; i++){
-    // get a random permutation 
-    auto perm = Rng::rand_perm(pop_size);
+    for(int i = 0; i < n_rounds; i++){
+      // get a random permutation of the participants
+      auto & perm = sample_indices(pop_size, n_selected_per_round * tournament_size);
 
-    // apply tournaments
-    for(int j = 0; j < n_selected_per_round; j++) {
-      // one tournament instance
-      Node * winner = population[perm[j*tournament_size]];
-      for(int k=j*tournament_size + 1; k < (j+1)*tournament_size; k++){
-        if (population[perm[k]]->fitness < winner->fitness) {
-          winner = population[perm[k]];
+      // apply tournaments
+      for(int j = 0; j < n_selected_per_round; j++) {
+        // one tournament instance
+        int winner_idx = perm[j*tournament_size];
+        for(int k=j*tournament_size + 1; k < (j+1)*tournament_size; k++){
+          if (population[perm[k]]->fitness < population[winner_idx]->fitness) {
+            winner_idx = perm[k];
+          }
         }
+        select(winner_idx);
       }
-      selected.push_back(winner->clone());
     }
   }
+
+  // moved-out winners are no longer owned by the population
+  for(int i = 0; i < taken.size(); i++) {
+    if (taken[i])
+      population[i] = NULL;
+  }
   return selected;
 }
 
-#endif
\ No newline at end of file
+#endif
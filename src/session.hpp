@@ -0,0 +1,157 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <vector>
+#include <string>
+
+#include "globals.hpp"
+#include "util.hpp"
+#include "myeig.hpp"
+#include "ims.hpp"
+#include "program.hpp"
+#include "profiling.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  A session keeps the configuration, the data, and the state of the search (populations, 
+  FOS builders with their linkage bias, elites) alive across calls, so that the same 
+  setting can be refit on updated data starting from where the previous search left off.
+  Note that the configuration lives in the global namespace `g`, hence only one session 
+  should be in use at any given time.
+*/
+struct Session {
+
+  IMS * ims = NULL;
+
+  // options as they were parsed (continue_fit can scale the budget & feature selection can change the probs.)
+  int max_generations, max_time, max_evaluations;
+  long long max_node_evaluations;
+  string lib_tset_probs;
+  // called at the end of every macro generation of the IMS
+  function<void(IMS&)> on_macro_generation;
+
+  // Uses the options already parsed into `g`
+  Session() {
+    _store_options();
+  }
+
+  Session(string options) {
+    auto opts = split_string(options, " ");
+    int argc = opts.size()+1;
+    char * argv[argc];
+    string title = "gpg";
+    argv[0] = (char*) title.c_str();
+    for (int i = 1; i < argc; i++) {
+      argv[i] = (char*) opts[i-1].c_str();
+    }
+    g::read_options(argc, argv);
+    _store_options();
+  }
+
+  void _store_options() {
+    max_generations = g::max_generations;
+    max_time = g::max_time;
+    max_evaluations = g::max_evaluations;
+    max_node_evaluations = g::max_node_evaluations;
+    lib_tset_probs = g::lib_tset_probs;
+  }
+
+  ~Session() {
+    if (ims)
+      delete ims;
+    jit::release();
+  }
+
+  void _set_budget(float budget_fraction) {
+    g::max_generations = max_generations > -1 ? max((int) (max_generations * budget_fraction), 1) : -1;
+    g::max_time = max_time > -1 ? max((int) (max_time * budget_fraction), 1) : -1;
+    g::max_evaluations = max_evaluations > -1 ? max((int) (max_evaluations * budget_fraction), 1) : -1;
+    g::max_node_evaluations = max_node_evaluations > -1 ? max((long long) (max_node_evaluations * budget_fraction), (long long) 1) : -1;
+    // budget counters
+    ims->macro_generations = 0;
+    g::fit_func->evaluations = 0;
+    g::fit_func->node_evaluations = 0;
+  }
+
+  // Runs the search from scratch, for the given fraction of the configured budget
+  void fit(Mat & X, Vec & y, float budget_fraction=1.0) {
+    if (ims)
+      delete ims;
+    ims = new IMS();
+    ims->on_macro_generation = on_macro_generation;
+    if (g::random_state >= 0) {
+      Rng::set_stream(0); // re-seed so that repeated fits are reproducible
+    }
+
+    // set training set
+    g::fit_func->set_Xy(X, y);
+    // set terminals
+    for(auto * t : g::terminals) {
+      delete t;
+    }
+    g::terminals.clear();
+    g::lib_tset_probs = lib_tset_probs;
+    g::set_terminals(g::lib_tset);
+    g::apply_feature_selection(g::lib_feat_sel_number);
+    g::set_terminal_probabilities(g::lib_tset_probs);
+    print("terminal set: ",g::str_terminal_set()," (probs: ",g::lib_tset_probs,")");
+    // set batch size
+    g::set_batch_size(g::lib_batch_size);
+    print("batch size: ", g::batch_size);
+
+    _set_budget(budget_fraction);
+    ims->run();
+  }
+
+  // Resumes the search on (possibly updated) data with the same schema, for the given fraction
+  // of the configured budget. The search is seeded with the previous populations and elites
+  void continue_fit(Mat & X, Vec & y, float budget_fraction=1.0) {
+    if (!ims) {
+      fit(X, y, budget_fraction);
+      return;
+    }
+    if (X.cols() != g::fit_func->X_train.cols()) {
+      throw runtime_error("The number of features differs from the one of the previous fit");
+    }
+
+    g::fit_func->set_Xy(X, y);
+    g::set_batch_size(g::lib_batch_size);
+    ims->warm_start();
+
+    _set_budget(budget_fraction);
+    ims->run();
+  }
+
+  vector<string> models() {
+    if (!ims || ims->final_elites.empty()) {
+      throw runtime_error("Not models found, something went wrong");
+    }
+    vector<string> models; models.reserve(ims->final_elites.size());
+    for (auto it = ims->final_elites.begin(); it != ims->final_elites.end(); it++) {
+      models.push_back(it->second->human_repr());
+    }
+    return models;
+  }
+
+  // Profiling records of the last (continued) fit, empty if profiling is disabled
+  vector<prof::Record> profile() {
+    return prof::records;
+  }
+
+  // Serialised programs of the models, in the same order as `models()`
+  vector<string> programs() {
+    if (!ims || ims->final_elites.empty()) {
+      throw runtime_error("Not models found, something went wrong");
+    }
+    vector<string> programs; programs.reserve(ims->final_elites.size());
+    for (auto it = ims->final_elites.begin(); it != ims->final_elites.end(); it++) {
+      programs.push_back(serialize_program(it->second));
+    }
+    return programs;
+  }
+
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef SPECIALIZED_H
+#define SPECIALIZED_H
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "myeig.hpp"
+#include "node.hpp"
+#include "operator.hpp"
+#include "dataset.hpp"
+#include "util.hpp"
+
+using namespace std;
+using namespace myeig;
+
+/*
+  Evaluators specialized at compile time for common function sets.
+  `Evaluator<Ops...>` flattens a tree into a post-order program where each function is an opcode,
+  its position in the type list Ops, and runs the program with a table of kernels (the static
+  `eval` of each operator, see operator.hpp) indexed by opcode. Kernels are instantiated for the
+  types in Ops, so they are inlined into the table and called on the output vectors of the
+  children directly, without virtual calls and without stacking the inputs into a matrix.
+  The program does what Node::get_output does, with the same arithmetic: constant subtrees are
+  folded to scalars (sampling the constants that have no value yet), and broadcast only where they
+  meet a feature-dependent branch, and outputs are rounded the same way, so that the outputs are
+  bit-identical to those of the generic path.
+  `select`, called by g::set_functions, picks the evaluator of the function set, if any; trees with
+  operators outside of that set (and all trees, for other function sets) use the generic path.
+*/
+
+namespace spec {
+
+  const int FEAT = -1, CONST = -2, UNKNOWN = -3;
+
+  struct Instr {
+    int code; // opcode, or FEAT, CONST
+    int arg; // feature id
+    float c; // constant
+    int children[2]; // positions in the program
+  };
+
+  template<typename O, typename = void>
+  struct is_binary : false_type {};
+
+  template<typename O>
+  struct is_binary<O, void_t<decltype(O::eval(declval<Vec&>(), declval<Vec&>()))>> : true_type {};
+
+  template<typename... Ops>
+  struct Evaluator {
+
+    typedef Vec (*Kernel)(Vec ** args);
+
+    template<typename O>
+    static Vec _kernel(Vec ** args) {
+      if constexpr (is_binary<O>::value)
+        return O::eval(*args[0], *args[1]);
+      else
+        return O::eval(*args[0]);
+    }
+
+    static constexpr Kernel kernels[] = {&_kernel<Ops>...};
+    static constexpr int arities[] = {(is_binary<Ops>::value ? 2 : 1)...};
+
+    static int opcode(Op * op) {
+      const type_info & t = typeid(*op);
+      if (t == typeid(Feat))
+        return FEAT;
+      if (t == typeid(Const))
+        return CONST;
+      int code = UNKNOWN, i = 0;
+      ((code = (code == UNKNOWN && t == typeid(Ops)) ? i : code, i++), ...);
+      return code;
+    }
+
+    // Appends the program of the subtree to prog; returns its position, -1 if an operator is not in Ops
+    static int compile(Node * n, vector<Instr> & prog) {
+      Instr instr;
+      instr.code = opcode(n->op);
+      if (instr.code == UNKNOWN)
+        return -1;
+      if (instr.code == FEAT) {
+        instr.arg = ((Feat*) n->op)->id;
+      } else if (instr.code == CONST) {
+        Const * k = (Const*) n->op;
+        if (isnan(k->c))
+          k->_sample();
+        instr.c = k->c;
+      } else {
+        for (int i = 0; i < arities[instr.code]; i++) {
+          instr.children[i] = compile(n->children[i], prog);
+          if (instr.children[i] < 0)
+            return -1;
+        }
+      }
+      prog.push_back(instr);
+      return prog.size() - 1;
+    }
+
+    // Output of the program on X; false (and out untouched) if it could not be compiled
+    static bool evaluate(Node * tree, const MatRef & X, Vec & out) {
+      thread_local vector<Instr> prog;
+      prog.clear();
+      if (compile(tree, prog) < 0)
+        return false;
+
+      int n = X.rows();
+      int len = prog.size();
+      vector<Vec> outs(len);
+      vector<bool> is_const(len);
+      vector<float> consts(len);
+      for (int p = 0; p < len; p++) {
+        Instr & instr = prog[p];
+        if (instr.code == CONST) {
+          is_const[p] = true;
+          consts[p] = instr.c;
+          continue;
+        }
+        if (instr.code == FEAT) {
+          is_const[p] = false;
+          outs[p] = dataset::feature(X, instr.arg);
+          continue;
+        }
+
+        int a = arities[instr.code];
+        bool all_const = true;
+        for (int i = 0; i < a; i++)
+          all_const &= is_const[instr.children[i]];
+        Vec broadcast[2];
+        Vec * args[2];
+        if (all_const) {
+          for (int i = 0; i < a; i++) {
+            broadcast[i] = Vec::Constant(1, consts[instr.children[i]]);
+            args[i] = &broadcast[i];
+          }
+          is_const[p] = true;
+          consts[p] = ((kernels[instr.code](args) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION))[0];
+          continue;
+        }
+        for (int i = 0; i < a; i++) {
+          int ch = instr.children[i];
+          if (is_const[ch]) {
+            broadcast[i] = Vec::Constant(n, consts[ch]);
+            args[i] = &broadcast[i];
+          } else {
+            args[i] = &outs[ch];
+          }
+        }
+        is_const[p] = false;
+        outs[p] = (kernels[instr.code](args) * pow(10.0, NUM_PRECISION)) / (float) pow(10.0,NUM_PRECISION);
+        // the outputs of the children are not needed anymore
+        for (int i = 0; i < a; i++)
+          outs[instr.children[i]].resize(0);
+      }
+
+      if (is_const[len - 1])
+        out = Vec::Constant(n, consts[len - 1]);
+      else
+        out.swap(outs[len - 1]);
+      return true;
+    }
+  };
+
+  typedef bool (*EvaluateFn)(Node * tree, const MatRef & X, Vec & out);
+
+  struct Specialization {
+    string name;
+    vector<string> syms; // of the function set
+    EvaluateFn evaluate;
+  };
+
+  inline vector<Specialization> specializations = {
+    {"arithmetic", {"+", "-", "*", "/"}, &Evaluator<Add, Sub, Mul, Div>::evaluate},
+    {"default", {"+", "-", "*", "/", "sin", "cos", "log"}, &Evaluator<Add, Sub, Mul, Div, Sin, Cos, Log>::evaluate},
+    {"all", {"+", "-", "¬", "*", "/", "1/", "**2", "sqrt", "**3", "sin", "cos", "log"},
+      &Evaluator<Add, Sub, Neg, Mul, Div, Inv, Square, Sqrt, Cube, Sin, Cos, Log>::evaluate},
+  };
+
+  inline EvaluateFn selected = NULL; // NULL: generic path
+  inline string selected_name = "generic";
+
+  // Picks the evaluator specialized for exactly the given function set, if any
+  inline void select(vector<Op*> & functions) {
+    selected = NULL;
+    selected_name = "generic";
+    vector<string> syms;
+    for (Op * op : functions)
+      syms.push_back(op->sym());
+    sort(syms.begin(), syms.end());
+    syms.erase(unique(syms.begin(), syms.end()), syms.end());
+    for (Specialization & s : specializations) {
+      vector<string> s_syms = s.syms;
+      sort(s_syms.begin(), s_syms.end());
+      if (s_syms == syms) {
+        selected = s.evaluate;
+        selected_name = s.name;
+        return;
+      }
+    }
+  }
+
+  // Output of tree on X, with the selected evaluator if it applies
+  inline Vec get_output(Node * tree, const MatRef & X) {
+    Vec out;
+    if (selected && selected(tree, X, out))
+      return out;
+    return tree->get_output(X);
+  }
+
+}
+
+#endif
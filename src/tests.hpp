@@ -7,6 +7,10 @@
 #include "operator.hpp"
 #include "fitness.hpp"
 #include "variation.hpp"
+#include "batch_evaluation.hpp"
+#include "program.hpp"
+#include "specialized.hpp"
+#include "jit.hpp"
 
 using namespace std;
 using namespace myeig;
@@ -16,11 +20,21 @@ struct Test {
   void run_all() {
     depth();
     subtree();
+    introns();
     gen_tree();
     operators();
     node_output();
+    shared_subtree_output();
+    specialized_output();
+    jit_output();
+    program();
     fitness();
+    evaluation_pool();
     converge();
+    selection();
+    gom();
+    rng();
+    scheduler();
     math();
   }
 
@@ -77,6 +91,34 @@ struct Test {
 
   }
 
+  void introns() {
+    // [* x_0 + x_1 x_1] has no introns
+    Node * tree = _generate_mock_tree();
+    auto nodes = tree->subtree();
+    assert(tree->get_num_nodes(true) == 5);
+
+    // [¬ x_0 + x_1 x_1]: the last three nodes become introns
+    Op * replaced_op = tree->op;
+    tree->op = new Neg();
+    tree->update_activity(nodes, 0);
+    assert(tree->get_num_nodes(true) == 2);
+    for(int i = 0; i < nodes.size(); i++)
+      assert(tree->get_active_mask()[i] == !nodes[i]->is_intron());
+    assert(tree->get_num_nodes(false) == 5);
+
+    // and back
+    delete tree->op;
+    tree->op = replaced_op;
+    tree->update_activity(nodes, 0);
+    assert(tree->get_num_nodes(true) == 5);
+
+    // clones carry the mask along
+    Node * tree_clone = tree->clone();
+    assert(tree_clone->get_num_nodes(true) == 5);
+    tree_clone->clear();
+    tree->clear();
+  }
+
   void gen_tree() {
     vector<Op*> functions = {new Add(), new Sub(), new Mul()};
     vector<Op*> terminals = {new Feat(0), new Feat(1)};
@@ -145,6 +187,214 @@ struct Test {
     mock_tree->clear();
 
     assert(result.isApprox(expected));
+
+    // feature-free subtrees: (3 * -0.5) + x_1, and 3 * -0.5 alone
+    Node * add_node = new Node(new Add());
+    Node * mul_node = new Node(new Mul());
+    mul_node->append(new Node(new Const(3)));
+    mul_node->append(new Node(new Const(-0.5)));
+    add_node->append(mul_node);
+    add_node->append(new Node(new Feat(1)));
+    expected << 0.5, 2.5, 4.5;
+    result = add_node->get_output(X);
+    assert(result.isApprox(expected));
+    expected << -1.5, -1.5, -1.5;
+    result = mul_node->get_output(X);
+    assert(result.isApprox(expected));
+    add_node->clear();
+  }
+
+  void shared_subtree_output() {
+    Mat X(3,2);
+    X << 1, 2,
+         3, 4,
+         5, 6;
+
+    // two identical trees and one that shares the subtree (x_1 + x_1) with them
+    vector<Node*> trees;
+    for(int i = 0; i < 3; i++)
+      trees.push_back(_generate_mock_tree());
+    delete trees[2]->op;
+    trees[2]->op = new Sub();
+
+    SubtreeDAG dag;
+    for(int i = 0; i < 3; i++)
+      dag.add_tree(trees[i], i);
+    // [* x_0 + x_1 x_1] and [- x_0 + x_1 x_1] have 3 distinct nodes + 2 roots
+    assert(dag.dag_nodes.size() == 5);
+
+    int num_consumed = 0;
+    dag.evaluate(X, [&](int i, Vec & out) {
+      Vec expected = trees[i]->get_output(X);
+      assert(out.isApprox(expected));
+      num_consumed++;
+    });
+    assert(num_consumed == 3);
+
+    for(Node * t : trees)
+      t->clear();
+  }
+
+  void specialized_output() {
+    Mat X(3,2);
+    X << 1, 2,
+         3, 0,
+         5, 6;
+
+    // x_0 * (x_1 + x_1), and x_0 / ((2 - 3) * x_1), whose constant subtree is folded
+    Node * tree = _generate_mock_tree();
+    Node * div_node = new Node(new Div());
+    Node * mul_node = new Node(new Mul());
+    Node * sub_node = new Node(new Sub());
+    sub_node->append(new Node(new Const(2)));
+    sub_node->append(new Node(new Const(3)));
+    mul_node->append(sub_node);
+    mul_node->append(new Node(new Feat(1)));
+    div_node->append(new Node(new Feat(0)));
+    div_node->append(mul_node);
+
+    typedef spec::Evaluator<Add, Sub, Mul, Div> Arithmetic;
+    for (Node * t : {tree, div_node}) {
+      Vec out;
+      bool specialized = Arithmetic::evaluate(t, X, out);
+      assert(specialized);
+      Vec expected = t->get_output(X);
+      // bit-identical, including the division by 0
+      assert(memcmp(out.data(), expected.data(), out.size() * sizeof(float)) == 0);
+    }
+
+    // operators outside of the set fall back to the generic path
+    Node * sin_node = new Node(new Sin());
+    sin_node->append(tree);
+    Vec out;
+    bool specialized = Arithmetic::evaluate(sin_node, X, out);
+    assert(!specialized);
+    specialized = spec::Evaluator<Add, Mul, Sin>::evaluate(sin_node, X, out);
+    assert(specialized);
+    assert(out.isApprox(sin_node->get_output(X)));
+
+    sin_node->clear();
+    div_node->clear();
+  }
+
+  void jit_output() {
+    Mat X(3,2);
+    X << 1, 2,
+         3, 0,
+         5, 6;
+
+    // x_0 / (x_1 + x_1), and log(x_0) whose clipping must match that of the interpreter
+    Node * tree = _generate_mock_tree();
+    delete tree->op;
+    tree->op = new Div();
+    Node * log_node = new Node(new Log());
+    log_node->append(new Node(new Feat(0)));
+    assert(jit::source(tree).find("gpg_kernel") != string::npos);
+
+    // one kernel is compiled whenever there is a compiler, all of them with -jit
+    if (jit::available()) {
+      jit::Kernel k = jit::kernel(tree, true);
+      assert(k);
+      Vec out(X.rows());
+      k(X.data(), X.rows(), X.rows(), out.data());
+      Vec expected = tree->get_output(X);
+      assert(memcmp(out.data(), expected.data(), out.size() * sizeof(float)) == 0);
+    }
+    if (jit::enabled && jit::kernel(tree, true)) {
+      for (Node * t : {tree, log_node}) {
+        jit::kernel(t, true);
+        Vec out;
+        bool compiled = jit::compiled_output(t, X, out);
+        assert(compiled);
+        Vec expected = t->get_output(X);
+        assert(memcmp(out.data(), expected.data(), out.size() * sizeof(float)) == 0);
+      }
+      // row blocks are read in place
+      Vec predicted = predict_batch(tree, X, 1, 2);
+      Vec expected = tree->get_output(X);
+      assert(memcmp(predicted.data(), expected.data(), predicted.size() * sizeof(float)) == 0);
+    }
+
+    // uses are counted for a bounded number of trees
+    int max_counted = jit::max_counted;
+    jit::max_counted = 2;
+    vector<string> sources;
+    for (float c : {1.0f, 2.0f, 3.0f}) {
+      Node * add_node = new Node(new Add());
+      add_node->append(new Node(new Feat(0)));
+      add_node->append(new Node(new Const(c)));
+      jit::kernel(add_node);
+      sources.push_back(jit::source(add_node));
+      add_node->clear();
+    }
+    assert(jit::cache().counted.size() == 2 && jit::cache().entries.count(sources[0]) == 0);
+    jit::max_counted = max_counted;
+    jit::release();
+    assert(jit::cache().entries.empty() && jit::cache().handles.empty());
+
+    tree->clear();
+    log_node->clear();
+  }
+
+  void program() {
+    Mat X(3,2);
+    X << 1, 2,
+         3, 4,
+         5, 6;
+
+    // [- x_0 sin(c)] plus an intron child under sin
+    Node * tree = new Node(new Sub());
+    Node * sin_node = new Node(new Sin());
+    sin_node->append(new Node(new Const(0.5)));
+    sin_node->append(new Node(new Feat(1)));
+    tree->append(new Node(new Feat(0)));
+    tree->append(sin_node);
+
+    string bytes = serialize_program(tree);
+    int num_features;
+    Node * decoded = deserialize_program(bytes, &num_features);
+    assert(num_features == 1);
+    assert(decoded->subtree().size() == 4);
+    assert(decoded->human_repr() == tree->human_repr());
+
+    Vec expected = tree->get_output(X);
+    Vec result = predict_batch(bytes, X);
+    assert(result.isApprox(expected));
+    // row blocks
+    result = predict_batch(decoded, X, 2, 2);
+    assert(result.isApprox(expected));
+
+    bool thrown = false;
+    try {
+      deserialize_program(bytes.substr(0, bytes.size()-1));
+    } catch (runtime_error & e) {
+      thrown = true;
+    }
+    assert(thrown);
+
+    // feature ids outside of the columns the header declares
+    for (int32_t bad_id : {-1, 1, 100000000}) {
+      string bad_bytes = bytes;
+      size_t pos = bad_bytes.find((char) OPCODE_FEAT, 13);
+      memcpy(&bad_bytes[pos + 1], &bad_id, sizeof(int32_t));
+      thrown = false;
+      try {
+        deserialize_program(bad_bytes);
+      } catch (runtime_error & e) {
+        thrown = string(e.what()) == "Malformed program";
+      }
+      assert(thrown);
+    }
+
+    // genotypes keep the introns
+    Node * genotype = deserialize_genotype(serialize_genotype(tree));
+    assert(genotype->subtree().size() == tree->subtree().size());
+    assert(genotype->children[1]->children.size() == 2);
+    assert(genotype->get_output(X).isApprox(expected));
+    genotype->clear();
+
+    tree->clear();
+    decoded->clear();
   }
 
   void fitness() {
@@ -167,10 +417,65 @@ struct Test {
     float res = f->get_fitness(mock_tree, X, y);
 
     assert(res == expected);
+
+    // padding rows of X (see dataset.hpp) do not affect the fitness
+    Mat X_padded = dataset::padded(X);
+    assert(X_padded.rows() == dataset::SIMD_FLOATS && X_padded.topRows(3).isApprox(X));
+    assert((X_padded.row(15) == X.row(2)).all());
+#if EIGEN_MAX_ALIGN_BYTES >= 64
+    assert(dataset::cache_line_aligned(X_padded));
+#endif
+    assert(f->get_fitness(mock_tree, X_padded, y) == expected);
+
+    // 16-bit storage: these values are exact in both formats, features are widened on load
+    for (auto p : {dataset::dpBFloat16, dataset::dpFloat16}) {
+      Mat X_packed = dataset::packed(X, p);
+      assert(X_packed.rows() == 3 && X_packed.cols() == 1);
+      dataset::PackedScope packed_scope(p);
+      assert((dataset::feature(X_packed, 0) == X.col(0)).all() && (dataset::feature(X_packed, 1) == X.col(1)).all());
+      assert(f->get_fitness(mock_tree, X_packed, y) == expected);
+    }
+    assert(dataset::from_float16(dataset::to_float16(-0.1f)) == -0.099975586f);
+    assert(dataset::from_float16(dataset::to_float16(1e-6f)) > 0); // subnormal
+    assert(isinf(dataset::from_float16(dataset::to_float16(1e5f))));
     delete f;
     mock_tree->clear();
   }
 
+  void evaluation_pool() {
+    Mat X(4,2);
+    X << 1, 2,
+         3, 4,
+         5, 6,
+         7, 0;
+    Vec y(4);
+    y << 1, 0, 1, 2;
+
+    // x_0 ? (x_1 + x_1), for a few ?
+    vector<Node*> population;
+    for (Op * op : vector<Op*>{new Mul(), new Sub(), new Div(), new Add()}) {
+      Node * tree = _generate_mock_tree();
+      delete tree->op;
+      tree->op = op;
+      population.push_back(tree);
+    }
+
+    // the workers evaluate on the shared batch, and must agree with the search process
+    Fitness * f = new MSEFitness();
+    f->set_Xy(X, y);
+    Vec expected = f->get_fitnesses(population);
+    int num_workers = evalpool::num_workers;
+    evalpool::num_workers = 2;
+    Vec fitnesses = f->get_fitnesses(population);
+    evalpool::stop();
+    evalpool::num_workers = num_workers;
+    assert((fitnesses == expected).all());
+
+    delete f;
+    for (Node * tree : population)
+      tree->clear();
+  }
+
   void converge() {
     Evolution * e = new Evolution(0);
 
@@ -193,6 +498,214 @@ struct Test {
     delete e;
   }
 
+  void selection() {
+    vector<Node*> population;
+    for(int i = 0; i < 8; i++) {
+      population.push_back(_generate_mock_tree());
+      population[i]->fitness = i;
+    }
+
+    // the best can never lose a tournament
+    assert(tournament(population, 8)->fitness == 0);
+
+    // winners moved out of the population are not copies, repeated winners are
+    auto selected = popwise_tournament(population, 8, 2, false, true);
+    assert(selected.size() == 8);
+    for(int i = 0; i < 8; i++) {
+      assert(selected[i]->fitness < 7);
+      for(int j = i+1; j < 8; j++)
+        assert(selected[i] != selected[j]);
+    }
+    assert(find(population.begin(), population.end(), (Node*) NULL) != population.end());
+
+    Evolution * e = new Evolution(0);
+    e->clear_population(population);
+    e->clear_population(selected);
+    delete e;
+  }
+
+  // GOM as it was performed in one go, before GOMTask, as a reference
+  Node * _gom_in_one_go(Node * parent, vector<Node*> & population, vector<vector<int>> & fos) {
+    Node * offspring = parent->clone();
+    float backup_fitness = parent->fitness;
+    vector<Node*> offspring_nodes = offspring->subtree();
+    auto random_fos_order = Rng::rand_perm(fos.size());
+    bool ever_improved = false;
+    for(int fos_idx = 0; fos_idx < fos.size(); fos_idx++) {
+      auto crossover_mask = fos[random_fos_order[fos_idx]];
+      vector<Op*> backup_ops;
+      vector<int> effectively_changed_indices;
+      Node * donor = population[Rng::randi(population.size())];
+      vector<Node*> donor_nodes = donor->subtree();
+      for(int idx : crossover_mask) {
+        if (offspring_nodes[idx]->op->sym() == donor_nodes[idx]->op->sym())
+          if (g::cmut_prob <= 0 || g::cmut_temp <= 0 || donor_nodes[idx]->op->type() != OpType::otConst)
+            continue;
+        backup_ops.push_back(offspring_nodes[idx]->op);
+        offspring_nodes[idx]->op = donor_nodes[idx]->op->clone();
+        effectively_changed_indices.push_back(idx);
+      }
+      coeff_mut(offspring, false, &effectively_changed_indices, &backup_ops);
+      bool change_is_meaningful = false;
+      for(int i : effectively_changed_indices)
+        change_is_meaningful = change_is_meaningful || !offspring_nodes[i]->is_intron();
+      float new_fitness = change_is_meaningful ? g::fit_func->get_fitness(offspring) : backup_fitness;
+      if (new_fitness > backup_fitness) {
+        for(int i = 0; i < effectively_changed_indices.size(); i++) {
+          delete offspring_nodes[effectively_changed_indices[i]]->op;
+          offspring_nodes[effectively_changed_indices[i]]->op = backup_ops[i]->clone();
+          offspring->fitness = backup_fitness;
+        }
+      } else if (new_fitness < backup_fitness) {
+        backup_fitness = new_fitness;
+        ever_improved = true;
+      }
+      for(Op * op : backup_ops)
+        delete op;
+    }
+    if(g::tournament_size > 1 && !ever_improved) {
+      vector<Node*> tournament_candidates;
+      for(int i = 0; i < g::tournament_size - 1; i++)
+        tournament_candidates.push_back(population[Rng::randi(population.size())]);
+      tournament_candidates.push_back(offspring);
+      Node * winner = tournament(tournament_candidates, g::tournament_size);
+      if (winner != offspring) {
+        offspring->clear();
+        offspring = winner->clone();
+      }
+    }
+    return offspring;
+  }
+
+  void gom() {
+    // (on the training set of the run, which must not count these evaluations, and in-process, as
+    // the worker pool can only be driven by one thread)
+    int evaluations = g::fit_func->evaluations;
+    long long node_evaluations = g::fit_func->node_evaluations;
+    int num_workers = evalpool::num_workers;
+    evalpool::num_workers = 0;
+
+    Rng::set_stream(0, 7);
+    reset_sample_indices();
+    vector<Node*> population;
+    for(int i = 0; i < 16; i++)
+      population.push_back(generate_tree(g::max_depth, g::init_strategy));
+    g::fit_func->get_fitnesses(population);
+    int genotype_length = population[0]->subtree().size();
+    vector<vector<int>> fos;
+    for(int i = 0; i < genotype_length; i++)
+      fos.push_back({i});
+    fos.push_back(create_range(genotype_length));
+
+    // GOMTask, driven one evaluation at a time, does what GOM in one go did
+    for(int i = 0; i < population.size(); i++) {
+      Rng::set_stream(0, 100 + i);
+      reset_sample_indices();
+      Node * expected = _gom_in_one_go(population[i], population, fos);
+      Rng::set_stream(0, 100 + i);
+      reset_sample_indices();
+      Node * offspring = efficient_gom(population[i], population, fos);
+      assert(offspring->str_subtree() == expected->str_subtree() && offspring->fitness == expected->fitness);
+      offspring->clear();
+      expected->clear();
+    }
+
+    // the offspring of parallel_gom do not depend on the number of threads
+    vector<string> reference;
+    for(int num_threads : {1, 2, 4}) {
+      Rng::set_stream(0, 42);
+      reset_sample_indices();
+      vector<Node*> offspring = parallel_gom(population, fos, num_threads);
+      vector<string> result;
+      for(Node * o : offspring) {
+        result.push_back(o->str_subtree() + " " + to_string(o->fitness));
+        o->clear();
+      }
+      if (reference.empty())
+        reference = result;
+      assert(result == reference);
+    }
+
+    // pipelined_gom gives an offspring per parent, of the template, and with its own fitness
+    vector<Node*> offspring = pipelined_gom(population, fos, 4);
+    assert(offspring.size() == population.size());
+    for(Node * o : offspring) {
+      assert(o && o->subtree().size() == genotype_length);
+      float fitness = o->fitness;
+      g::fit_func->get_fitness(o);
+      assert(o->fitness == fitness);
+      o->clear();
+    }
+
+    for(Node * tree : population)
+      tree->clear();
+    g::fit_func->evaluations = evaluations;
+    g::fit_func->node_evaluations = node_evaluations;
+    evalpool::num_workers = num_workers;
+    Rng::set_stream(0);
+    reset_sample_indices();
+  }
+
+  void rng() {
+    // permutations
+    auto perm = Rng::rand_perm(100);
+    vector<int> sorted_perm(perm);
+    sort(sorted_perm.begin(), sorted_perm.end());
+    assert(sorted_perm == create_range(100));
+
+    // bulk generation
+    Vec u = Rng::randu_vec(10001);
+    assert(u.minCoeff() >= 0 && u.maxCoeff() < 1);
+    assert(abs(u.mean() - 0.5) < 0.05);
+    Vec z = Rng::randn_vec(10001, 1.0, 2.0);
+    assert(abs(z.mean() - 1.0) < 0.1);
+    assert(abs(stddev(z) - 2.0) < 0.1);
+
+    // streams are reproducible and differ per worker
+    Rng::set_stream(1, 42);
+    double a = Rng::randu();
+    Rng::set_stream(2, 42);
+    double b = Rng::randu();
+    Rng::set_stream(1, 42);
+    assert(Rng::randu() == a && a != b);
+    Rng::set_stream(0);
+  }
+
+  void scheduler() {
+    // every index is visited once, with uneven work & any grain
+    for (int grain : {1, 7}) {
+      vector<atomic<int>> visits(1000);
+      parallel_for(1000, 4, [&](int i) {
+        double x = 0;
+        for (int k = 0; k < (i % 10) * 1000; k++)
+          x += sqrt(k);
+        visits[i] += x >= 0 ? 1 : 2;
+      }, grain);
+      for (auto & v : visits)
+        assert(v == 1);
+    }
+
+    // nested loops run serially, exceptions reach the caller
+    atomic<int> count{0};
+    parallel_for(8, 4, [&](int i) {
+      parallel_for(8, 4, [&](int j) { count++; });
+    });
+    assert(count == 64);
+    bool thrown = false;
+    try {
+      parallel_for(100, 4, [&](int i) {
+        if (i == 50)
+          throw runtime_error("failed iteration");
+      });
+    } catch (runtime_error & e) {
+      thrown = true;
+    }
+    assert(thrown);
+
+    // cpu lists of the NUMA topology
+    assert(numa::_parse_cpulist("0-3,8,10-11\n") == vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  }
+
   void math() {
     // correlation
     Vec x(5); 
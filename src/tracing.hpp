@@ -0,0 +1,194 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+  Timeline tracing of the search (option `-trace`), written in the Chrome Trace Event format,
+  which can be opened offline in Perfetto (ui.perfetto.dev) or chrome://tracing.
+  Each traced scope becomes a complete ("X") event carrying the id of the thread that ran it.
+  Macro generations, generations of the evolutions, linkage, batch updates, elite updates and
+  population evaluations are always traced; single GOM calls and single evaluations are traced
+  one every `-trace_sample` calls (per thread), as they are too many to trace all.
+  Events are buffered per thread and the file is (re-)written at the end of each run.
+  When tracing is disabled, a scope costs a single branch.
+*/
+
+namespace trace {
+
+  struct Event {
+    const char * name;
+    const char * category;
+    long long start_ns;
+    long long duration_ns;
+    int tid;
+    string args; // content of a JSON object, can be empty
+  };
+
+  inline bool enabled = false;
+  inline int sample_every = 0; // 0: single GOM calls & evaluations are not traced
+  inline size_t max_events = 1 << 22; // further events are dropped (& counted)
+
+  inline string out_path;
+  inline chrono::steady_clock::time_point origin;
+
+  inline mutex events_mutex;
+  inline vector<Event> events; // flushed from the thread buffers
+  inline atomic<long long> num_dropped{0};
+  inline atomic<int> next_tid{0};
+
+  inline long long now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+  }
+
+  inline void _flush(vector<Event> & buffer) {
+    if (buffer.empty())
+      return;
+    lock_guard<mutex> lock(events_mutex);
+    for (Event & e : buffer) {
+      if (events.size() < max_events)
+        events.push_back(std::move(e));
+      else
+        num_dropped++;
+    }
+    buffer.clear();
+  }
+
+  // Events of a thread, moved to `events` when full and when the thread terminates
+  struct ThreadBuffer {
+    int tid;
+    vector<Event> events;
+
+    ThreadBuffer() {
+      tid = next_tid++;
+      events.reserve(1024);
+    }
+
+    ~ThreadBuffer() {
+      _flush(events);
+    }
+  };
+
+  inline ThreadBuffer & _thread_buffer() {
+    thread_local ThreadBuffer buffer;
+    return buffer;
+  }
+
+  inline void record(const char * name, const char * category, long long start_ns, long long duration_ns, string args="") {
+    ThreadBuffer & b = _thread_buffer();
+    b.events.push_back(Event{name, category, start_ns, duration_ns, b.tid, std::move(args)});
+    if (b.events.size() >= 1024)
+      _flush(b.events);
+  }
+
+  // Moves the events of the calling thread to `events` (e.g., a worker of the scheduler going idle)
+  inline void flush_thread() {
+    _flush(_thread_buffer().events);
+  }
+
+  enum Sampled {
+    smGOM, smEvaluation, NUM_SAMPLED
+  };
+
+  // Whether the current call of a sampled scope should be traced (counted separately per kind)
+  inline bool sampled(Sampled kind) {
+    if (!enabled || sample_every <= 0)
+      return false;
+    thread_local int counters[NUM_SAMPLED] = {};
+    if (++counters[kind] < sample_every)
+      return false;
+    counters[kind] = 0;
+    return true;
+  }
+
+  struct Scope {
+    const char * name;
+    const char * category;
+    bool active;
+    long long start_ns;
+    string args;
+
+    Scope(const char * name, const char * category, bool active=true) {
+      this->active = active && enabled;
+      if (!this->active)
+        return;
+      this->name = name;
+      this->category = category;
+      start_ns = now_ns();
+    }
+
+    // Adds an argument shown with the event (only if traced)
+    void arg(const char * key, long long value) {
+      if (!active)
+        return;
+      args += (args.empty() ? "\"" : ", \"") + string(key) + "\": " + to_string(value);
+    }
+
+    ~Scope() {
+      if (active)
+        record(name, category, start_ns, now_ns() - start_ns, std::move(args));
+    }
+  };
+
+  inline void enable(string path, int sample) {
+    if (path.empty())
+      throw runtime_error("Missing path of the trace output file");
+    enabled = true;
+    out_path = path;
+    sample_every = sample;
+    origin = chrono::steady_clock::now();
+    lock_guard<mutex> lock(events_mutex);
+    events.clear();
+    num_dropped = 0;
+  }
+
+  inline void disable() {
+    enabled = false;
+    _thread_buffer().events.clear();
+    lock_guard<mutex> lock(events_mutex);
+    events.clear();
+    out_path = "";
+  }
+
+  // Writes all the events traced so far (the events of running threads other than the caller are
+  // included up to their last flush; the threads of the scheduler flush at the end of each loop)
+  inline void write() {
+    if (!enabled)
+      return;
+    flush_thread();
+    ofstream out(out_path);
+    if (!out.is_open())
+      throw runtime_error("Cannot open the trace output file: "+out_path);
+
+    lock_guard<mutex> lock(events_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << num_dropped << "}, \"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"gpg\"}}";
+    for (int t = 0; t < next_tid; t++)
+      out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t << ", \"args\": {\"name\": \"thread " << t << "\"}}";
+    char buf[64];
+    for (Event & e : events) {
+      // microseconds, with ns resolution
+      out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid;
+      snprintf(buf, sizeof(buf), "%.3f", e.start_ns / 1e3);
+      out << ", \"ts\": " << buf;
+      snprintf(buf, sizeof(buf), "%.3f", e.duration_ns / 1e3);
+      out << ", \"dur\": " << buf;
+      if (!e.args.empty())
+        out << ", \"args\": {" << e.args << "}";
+      out << "}";
+    }
+    out << "\n]}\n";
+  }
+
+}
+
+#endif
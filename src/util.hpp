@@ -7,15 +7,24 @@
 #include <fstream>
 #include <chrono>
 #include <iterator>
+#include <thread>
 #include "myeig.hpp"
+#include "scheduler.hpp"
 
 using namespace std;
 using namespace myeig;
 
 typedef std::chrono::steady_clock Clock;
 
+namespace g {
+  // whether print writes to cout (set by g::read_options, declared here so that print can check it)
+  inline bool verbose = true;
+}
+
 template<typename T>
 void print(vector<T> & v) {
+  if (!g::verbose)
+    return;
   for (auto & el : v) {
     cout << el << " ";
   }
@@ -25,18 +34,25 @@ void print(vector<T> & v) {
 template<class... Args>
 void print(Args... args)
 {
-  (cout << ... << args) << "\n";
+  if (g::verbose)
+    (cout << ... << args) << "\n";
+}
+
+// Calls f(i) for i in [0, n) on (at most) num_threads threads of the work-stealing scheduler (see scheduler.hpp)
+template<typename F>
+void parallel_for(int n, int num_threads, F f, int grain=1) {
+  sched::parallel_for(n, num_threads, f, grain);
 }
 
-float roundd(float x, int num_dec) {
+inline float roundd(float x, int num_dec) {
   return round(x * pow(10.0,num_dec)) / (float) pow(10.0,num_dec);
 }
 
-Vec roundd(Vec & x, int num_dec) {
+inline Vec roundd(Vec & x, int num_dec) {
   return (x * pow(10.0,num_dec)).round() / (float) pow(10.0,num_dec);
 }
 
-float median(Vec & x) {
+inline float median(Vec & x) {
   int n = x.size();
   if (n == 0) {
     throw runtime_error("Attempted to get median of empty array");
@@ -50,7 +66,7 @@ float median(Vec & x) {
   return x[n/2];
 }
 
-Veci sort_order(Vec & x) {
+inline Veci sort_order(Vec & x) {
   Veci indices(x.size());
   for(int i = 0; i < x.size(); i++)
     indices[i] = i;
@@ -60,7 +76,7 @@ Veci sort_order(Vec & x) {
   return indices;
 }
 
-Veci ranking(Vec & x) {
+inline Veci ranking(Vec & x) {
   Veci o = sort_order(x);
   Veci r(o.size());
   for (int i = 0; i < o.size(); i++) {
@@ -69,20 +85,20 @@ Veci ranking(Vec & x) {
   return r;
 }
 
-auto clip(Vec & x, float min, float max=INF)
+inline auto clip(Vec & x, float min, float max=INF)
 {
   return x.cwiseMin(min).cwiseMax(max);
 }
 
-float variance(Vec & x) {
+inline float variance(Vec & x) {
   return (x.array() - x.mean()).square().mean();
 }
 
-float stddev(Vec & x) {
+inline float stddev(Vec & x) {
   return sqrt(variance(x));
 }
 
-float corr(Vec & x, Vec & y) {
+inline float corr(const VecRef & x, const VecRef & y) {
   float mean_x = x.mean();
   float mean_y = y.mean();
 
@@ -100,7 +116,7 @@ float corr(Vec & x, Vec & y) {
   return result;
 }
 
-float spearcorr(Vec & x, Vec & y) {
+inline float spearcorr(Vec & x, Vec & y) {
   Veci r_x = ranking(x);
   Veci r_y = ranking(y);
   Vec r_x_f = r_x.cast<float>();
@@ -108,7 +124,7 @@ float spearcorr(Vec & x, Vec & y) {
   return corr(r_x_f, r_y_f);
 }
 
-int argmax(Vec & x) {
+inline int argmax(Vec & x) {
   int idx = -1;
   float best = NINF;
   for(int i = 0; i < x.size(); i++) {
@@ -120,7 +136,7 @@ int argmax(Vec & x) {
   return idx;
 }
 
-int argmin(Vec & x) {
+inline int argmin(Vec & x) {
   int idx = -1;
   float best = INF;
   for(int i = 0; i < x.size(); i++) {
@@ -132,7 +148,7 @@ int argmin(Vec & x) {
   return idx;
 }
 
-pair<float, float> linear_scaling_coeffs(Vec & y, Vec & p) {
+inline pair<float, float> linear_scaling_coeffs(Vec & y, Vec & p) {
 
   float interc, slope;
   float y_mean = y.mean();
@@ -154,11 +170,11 @@ pair<float, float> linear_scaling_coeffs(Vec & y, Vec & p) {
   return make_pair(interc, slope);    
 }
 
-auto tick() {
+inline auto tick() {
   return Clock::now();
 }
 
-float tock(chrono::time_point<Clock> tick) {
+inline float tock(chrono::time_point<Clock> tick) {
   auto now = Clock::now();
   auto duration = now - tick;
   return chrono::duration_cast<chrono::milliseconds>(duration).count() / 1000.0;
@@ -177,7 +193,7 @@ vector<int> argsort(const vector<T> &array) {
   return indices;
 }
 
-Vec replace(Vec & x, float what, float with, string condition="=") {
+inline Vec replace(Vec & x, float what, float with, string condition="=") {
   // returns a copy 
   Vec r(x);
   if (condition == "=") {
@@ -206,14 +222,14 @@ Vec replace(Vec & x, float what, float with, string condition="=") {
   return r;
 }
   
-vector<int> create_range(int n) {
+inline vector<int> create_range(int n) {
   vector<int> x; x.reserve(n);
   for(int i = 0; i < n; i++)
     x.push_back(i);
   return x;
 }
 
-Mat remove_column(Mat & X, int col_idx) {
+inline Mat remove_column(Mat & X, int col_idx) {
   // returns a new matrix without that column (the original is not modified)
   Mat R(X.rows(), X.cols()-1);
   for(int i = 0; i < X.rows(); i++) {
@@ -226,7 +242,7 @@ Mat remove_column(Mat & X, int col_idx) {
   return R;
 }
 
-Mat load_csv(const std::string & path, char separator=',') {
+inline Mat load_csv(const std::string & path, char separator=',') {
   // parser from https://stackoverflow.com/questions/34247057/how-to-read-csv-file-and-assign-to-eigen-matrix
   ifstream indata;
   indata.open(path);
@@ -252,13 +268,13 @@ Mat load_csv(const std::string & path, char separator=',') {
   return R;
 }
 
-bool exists(string & file_path)
+inline bool exists(string & file_path)
 {
     std::ifstream file(file_path.c_str());
     return file.good();
 }
 
-string replace(string& source, const string& what, string with)
+inline string replace(string& source, const string& what, string with)
 {
   // Solution by Ingmar: https://stackoverflow.com/a/29752943
   string new_string;
@@ -280,7 +296,7 @@ string replace(string& source, const string& what, string with)
   return new_string;
 }
 
-vector<string> split_string(string & original, string delimiter=",") {
+inline vector<string> split_string(string & original, string delimiter=",") {
   vector<string> result;
   string changed_string = original;
   if (delimiter != " ") {
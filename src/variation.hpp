@@ -8,12 +8,13 @@
 #include "selection.hpp"
 #include "fos.hpp"
 #include "rng.hpp"
+#include "profiling.hpp"
 
 #include <vector>
 
 using namespace std;
 
-Op * _sample_operator(vector<Op *> & operators, Vec & cumul_probs) {
+inline Op * _sample_operator(vector<Op *> & operators, Vec & cumul_probs) {
   double r = Rng::randu();
   int i = 0;
   while (r > (double) cumul_probs[i]) {
@@ -22,15 +23,20 @@ Op * _sample_operator(vector<Op *> & operators, Vec & cumul_probs) {
   return operators[i]->clone();  
 }
 
-Op * _sample_function() {
+inline Op * _sample_function() {
   return _sample_operator(g::functions, g::cumul_fset_probs);
 }
 
-Op * _sample_terminal() {
-  return _sample_operator(g::terminals, g::cumul_tset_probs);
+inline Op * _sample_terminal() {
+  Op * op = _sample_operator(g::terminals, g::cumul_tset_probs);
+  // draw the value of a constant now rather than when it is first read, which can happen while
+  // another individual (possibly on another thread) uses this one as donor
+  if (op->type() == OpType::otConst && isnan(((Const*) op)->c))
+    ((Const*) op)->_sample();
+  return op;
 }
 
-Node * _grow_tree_recursive(int max_arity, int max_depth_left, int actual_depth_left, int curr_depth, float terminal_prob=.25) {
+inline Node * _grow_tree_recursive(int max_arity, int max_depth_left, int actual_depth_left, int curr_depth, float terminal_prob=.25) {
   Node * n = NULL;
 
   if (max_depth_left > 0) {
@@ -54,7 +60,7 @@ Node * _grow_tree_recursive(int max_arity, int max_depth_left, int actual_depth_
   return n;
 }
 
-Node * generate_tree(int max_depth, string init_type="hh") {
+inline Node * generate_tree(int max_depth, string init_type="hh") {
 
   int max_arity = 0;
   for(Op * op : g::functions) {
@@ -86,7 +92,7 @@ Node * generate_tree(int max_depth, string init_type="hh") {
   return tree;
 }
 
-Node * coeff_mut(Node * parent, bool return_copy=true, vector<int> * changed_indices = NULL, vector<Op*> * backup_ops = NULL) {
+inline Node * coeff_mut(Node * parent, bool return_copy=true, vector<int> * changed_indices = NULL, vector<Op*> * backup_ops = NULL) {
   Node * tree = parent;
   if (return_copy) {
     tree = parent->clone();
@@ -95,17 +101,29 @@ Node * coeff_mut(Node * parent, bool return_copy=true, vector<int> * changed_ind
   if (g::cmut_prob > 0 && g::cmut_temp > 0) {
     // apply coeff mut to all nodes that are constants
     vector<Node*> nodes = tree->subtree();
+    vector<int> const_indices; const_indices.reserve(nodes.size());
     for(int i = 0; i < nodes.size(); i++) {
+      if (nodes[i]->op->type() == OpType::otConst)
+        const_indices.push_back(i);
+    }
+    if (const_indices.empty())
+      return tree;
+
+    // draw the random numbers in bulk
+    Vec u = Rng::randu_vec(const_indices.size());
+    int num_mutated = (u < g::cmut_prob).count();
+    Vec z = Rng::randn_vec(num_mutated);
+    int z_idx = 0;
+
+    for(int j = 0; j < const_indices.size(); j++) {
+      int i = const_indices[j];
       Node * n = nodes[i];
-      if (
-        n->op->type() == OpType::otConst &&
-        Rng::randu() < g::cmut_prob
-      ) {
+      if (u[j] < g::cmut_prob) {
         float prev_c = ((Const*)n->op)->c;
         float std = g::cmut_temp*abs(prev_c);
         if (std < g::cmut_eps)
           std = g::cmut_eps;
-        float mutated_c = roundd(prev_c + Rng::randn()*std, NUM_PRECISION); 
+        float mutated_c = roundd(prev_c + z[z_idx++]*std, NUM_PRECISION); 
         ((Const*)n->op)->c = mutated_c;
         // case in which we are going through GOM
         if (changed_indices != NULL) {
@@ -121,7 +139,7 @@ Node * coeff_mut(Node * parent, bool return_copy=true, vector<int> * changed_ind
   return tree;
 }
 
-vector<int> _sample_crossover_mask(int num_nodes) {
+inline vector<int> _sample_crossover_mask(int num_nodes) {
   auto crossover_mask = Rng::rand_perm(num_nodes);
   int k = 1+sqrt(num_nodes)*abs(Rng::randn());
   k = min(k, num_nodes);
@@ -130,7 +148,7 @@ vector<int> _sample_crossover_mask(int num_nodes) {
   return crossover_mask;
 }
 
-Node * crossover(Node * parent, Node * donor) {
+inline Node * crossover(Node * parent, Node * donor) {
   Node * offspring = parent->clone();
   auto nodes = offspring->subtree();
   auto d_nodes = donor->subtree();
@@ -141,11 +159,12 @@ Node * crossover(Node * parent, Node * donor) {
     delete nodes[i]->op;
     nodes[i]->op = d_nodes[i]->op->clone();
   }
+  offspring->refresh_activity();
 
   return offspring;
 }
 
-Node * mutation(Node * parent, vector<Op*> & functions, vector<Op*> & terminals, float prob_fun = 0.75) {
+inline Node * mutation(Node * parent, vector<Op*> & functions, vector<Op*> & terminals, float prob_fun = 0.75) {
   Node * offspring = parent->clone();
   auto nodes = offspring->subtree();
 
@@ -160,6 +179,7 @@ Node * mutation(Node * parent, vector<Op*> & functions, vector<Op*> & terminals,
       nodes[i]->op = _sample_terminal();
     }
   }
+  offspring->refresh_activity();
 
   return offspring;
 }
@@ -207,25 +227,86 @@ Node * mutation(Node * parent, vector<Op*> & functions, vector<Op*> & terminals,
 }*/
 
 
-Node * efficient_gom(Node * parent, vector<Node*> & population, vector<vector<int>> & fos) {
-  Node * offspring = parent->clone();
-  float backup_fitness = parent->fitness;
-  vector<Node*> offspring_nodes = offspring->subtree();
+/*
+  GOM of one individual as an explicit state machine: `advance` applies FOS subsets until one
+  makes a meaningful change, which needs the offspring to be evaluated, and `resume` takes the
+  resulting fitness to accept or undo the change. This way, the evaluations of several
+  individuals can be gathered and carried out together (see `pipelined_gom`).
+  Random numbers are drawn in the same order as when GOM is performed in one go.
+*/
+struct GOMTask {
+  Node * offspring;
+  vector<Node*> * population;
+  vector<vector<int>> * fos;
+  vector<Node*> offspring_nodes;
+  vector<int> fos_order;
+  int fos_idx = 0;
+  float backup_fitness;
+  bool ever_improved = false;
+  // of the FOS subset being applied
+  vector<Op*> backup_ops;
+  vector<int> effectively_changed_indices;
+
+  GOMTask(Node * parent, vector<Node*> & population, vector<vector<int>> & fos) {
+    this->population = &population;
+    this->fos = &fos;
+    offspring = parent->clone();
+    backup_fitness = parent->fitness;
+    offspring_nodes = offspring->subtree();
+    Rng::rand_perm(fos.size(), fos_order);
+  }
 
-  auto random_fos_order = Rng::rand_perm(fos.size());
+  // Returns true if the offspring must be evaluated (then call `resume`), false when GOM is over
+  bool advance() {
+    while (fos_idx < fos->size()) {
+      if (_apply_subset())
+        return true;
+      // assume nothing changed
+      resume(backup_fitness);
+    }
+    _finish();
+    return false;
+  }
 
-  bool ever_improved = false;
-  for(int fos_idx = 0; fos_idx < fos.size(); fos_idx++) {
-    
-    auto crossover_mask = fos[random_fos_order[fos_idx]];
-    bool change_is_meaningful = false;
-    vector<Op*> backup_ops; backup_ops.reserve(crossover_mask.size());
-    vector<int> effectively_changed_indices; effectively_changed_indices.reserve(crossover_mask.size());
+  // Accepts or undoes the changes of the current FOS subset, given the fitness of the offspring
+  void resume(float new_fitness) {
+    // check is not worse
+    if (new_fitness > backup_fitness) {
+      // undo
+      for(int i = 0; i < effectively_changed_indices.size(); i++) {
+        int changed_idx = effectively_changed_indices[i];
+        Node * off_n = offspring_nodes[changed_idx];
+        Op * back_op = backup_ops[i];
+        bool arity_changes = off_n->op->arity() != back_op->arity();
+        delete off_n->op;
+        off_n->op = back_op->clone();
+        if (arity_changes)
+          offspring->update_activity(offspring_nodes, changed_idx);
+        offspring->fitness = backup_fitness;
+      }
+    } else if (new_fitness < backup_fitness) {
+      // it improved
+      backup_fitness = new_fitness;
+      ever_improved = true;
+    }
+
+    // discard backup
+    for(Op * op : backup_ops) {
+      delete op;
+    }
+    fos_idx++;
+  }
+
+  // Applies the next FOS subset, returns whether the change is meaningful
+  bool _apply_subset() {
+    auto & crossover_mask = (*fos)[fos_order[fos_idx]];
+    backup_ops.clear(); backup_ops.reserve(crossover_mask.size());
+    effectively_changed_indices.clear(); effectively_changed_indices.reserve(crossover_mask.size());
 
-    Node * donor = population[Rng::randi(population.size())];
+    Node * donor = (*population)[Rng::randi(population->size())];
     vector<Node*> donor_nodes = donor->subtree();
 
-    for(int & idx : crossover_mask) {
+    for(int idx : crossover_mask) {
       // check if swap is not necessary
       if (offspring_nodes[idx]->op->sym() == donor_nodes[idx]->op->sym()) {
         // might need to swap if the node is a constant that might be optimized
@@ -236,6 +317,8 @@ Node * efficient_gom(Node * parent, vector<Node*> & population, vector<vector<in
       // then execute the swap
       Op * replaced_op = offspring_nodes[idx]->op;
       offspring_nodes[idx]->op = donor_nodes[idx]->op->clone();
+      if (replaced_op->arity() != offspring_nodes[idx]->op->arity())
+        offspring->update_activity(offspring_nodes, idx);
       backup_ops.push_back(replaced_op);
       effectively_changed_indices.push_back(idx);
     }
@@ -244,66 +327,126 @@ Node * efficient_gom(Node * parent, vector<Node*> & population, vector<vector<in
     coeff_mut(offspring, false, &effectively_changed_indices, &backup_ops);
 
     // check if at least one change was meaningful
+    vector<bool> & active_mask = offspring->get_active_mask();
     for(int i : effectively_changed_indices) {
-      Node * n = offspring_nodes[i];
-      if (!n->is_intron()) {
-        change_is_meaningful = true;
-        break;
-      }
+      if (active_mask[i])
+        return true;
     }
+    return false;
+  }
 
-    // assume nothing changed
-    float new_fitness = backup_fitness;
-    if (change_is_meaningful) {
-      // gotta recompute
-      new_fitness = g::fit_func->get_fitness(offspring);
+  void _finish() {
+    // variant of forced improvement that is potentially less aggressive, & less expensive to carry out
+    if(g::tournament_size > 1 && !ever_improved) {
+      // make a tournament between tournament size - 1 candidates + offspring
+      vector<Node*> tournament_candidates; tournament_candidates.reserve(g::tournament_size - 1);
+      for(int i = 0; i < g::tournament_size - 1; i++) {
+        tournament_candidates.push_back((*population)[Rng::randi(population->size())]);
+      }
+      tournament_candidates.push_back(offspring);
+      Node * winner = tournament(tournament_candidates, g::tournament_size);
+      if (winner != offspring) {
+        offspring->clear();
+        offspring = winner->clone();
+      }
     }
+  }
+};
+
+inline Node * efficient_gom(Node * parent, vector<Node*> & population, vector<vector<int>> & fos) {
+  prof::ScopedTimer timer(prof::phGOM);
+  trace::Scope trace_scope("gom", "variation", trace::sampled(trace::smGOM));
+  GOMTask task(parent, population, fos);
+  while (task.advance()) {
+    // gotta recompute
+    task.resume(g::fit_func->get_fitness(task.offspring));
+  }
+  return task.offspring;
+}
 
-    // check is not worse
-    if (new_fitness > backup_fitness) {
-      // undo
-      for(int i = 0; i < effectively_changed_indices.size(); i++) {
-        int changed_idx = effectively_changed_indices[i];
-        Node * off_n = offspring_nodes[changed_idx];
-        Op * back_op = backup_ops[i];
-        delete off_n->op;
-        off_n->op = back_op->clone();
-        offspring->fitness = backup_fitness;
+/*
+  GOM of a whole population with up to `window` individuals in progress at once (option `-gom_window`):
+  each pauses when its offspring needs an evaluation, and the pending offspring are evaluated
+  together with get_fitnesses, so that the worker pool (`-eval_workers`) gets batches of requests
+  even though the FOS loop of each individual is sequential. An individual is replaced by the next
+  one as soon as its GOM is over. Returns the offspring, in the order of the parents.
+  Only useful with the worker pool: in-process, the batches are too small for shared-subtree
+  evaluation to pay off, and runs are slower than with one individual at a time.
+*/
+inline vector<Node*> pipelined_gom(vector<Node*> & population, vector<vector<int>> & fos, int window) {
+  prof::ScopedTimer timer(prof::phGOM);
+  trace::Scope trace_scope("pipelined_gom", "variation");
+  vector<Node*> offspring_population(population.size(), NULL);
+  vector<pair<int, GOMTask*>> in_progress; in_progress.reserve(window);
+  vector<Node*> to_evaluate; to_evaluate.reserve(window);
+  int next = 0;
+
+  while (true) {
+    // start new individuals until the window is full
+    while (in_progress.size() < window && next < population.size()) {
+      GOMTask * task = new GOMTask(population[next], population, fos);
+      if (task->advance()) {
+        in_progress.push_back(make_pair(next, task));
+      } else {
+        offspring_population[next] = task->offspring;
+        delete task;
       }
-    } else if (new_fitness < backup_fitness) {
-      // it improved
-      backup_fitness = new_fitness;
-      ever_improved = true;
+      next++;
     }
-
-    // discard backup
-    for(Op * op : backup_ops) {
-      delete op;
+    if (in_progress.empty())
+      break;
+
+    // evaluate all pending offspring at once, then let each continue
+    to_evaluate.clear();
+    for(auto & p : in_progress)
+      to_evaluate.push_back(p.second->offspring);
+    Vec fitnesses = g::fit_func->get_fitnesses(to_evaluate);
+
+    int num_kept = 0;
+    for(int i = 0; i < in_progress.size(); i++) {
+      GOMTask * task = in_progress[i].second;
+      task->resume(fitnesses[i]);
+      if (task->advance()) {
+        in_progress[num_kept++] = in_progress[i];
+      } else {
+        offspring_population[in_progress[i].first] = task->offspring;
+        delete task;
+      }
     }
-
+    in_progress.resize(num_kept);
   }
+  return offspring_population;
+}
 
-  // variant of forced improvement that is potentially less aggressive, & less expensive to carry out
-  if(g::tournament_size > 1 && !ever_improved) {
-    // make a tournament between tournament size - 1 candidates + offspring
-    vector<Node*> tournament_candidates; tournament_candidates.reserve(g::tournament_size - 1);
-    for(int i = 0; i < g::tournament_size - 1; i++) {
-      tournament_candidates.push_back(population[Rng::randi(population.size())]);
-    }
-    tournament_candidates.push_back(offspring);
-    Node * winner = tournament(tournament_candidates, g::tournament_size);
-    offspring->clear();
-    offspring = winner;
-  }
-  
-  return offspring;
+/*
+  GOM of a whole population on `num_threads` threads of the scheduler (option `-threads`), one
+  individual per task, so that threads that are done with small individuals steal the remaining
+  ones. Each individual draws from its own stream of the rng, keyed by its index and by a number
+  drawn from the rng of the caller, so that the result does not depend on which thread processes
+  what (nor on the number of threads). Returns the offspring, in the order of the parents.
+*/
+inline vector<Node*> parallel_gom(vector<Node*> & population, vector<vector<int>> & fos, int num_threads) {
+  trace::Scope trace_scope("parallel_gom", "variation");
+  vector<Node*> offspring_population(population.size(), NULL);
+  uint64_t key = Rng::get()();
+  Xoshiro::Xoshiro256PP caller_rng = Rng::get();
+  parallel_for(population.size(), num_threads, [&](int i) {
+    Rng::set_stream(0, key + i + 1);
+    reset_sample_indices();
+    offspring_population[i] = efficient_gom(population[i], population, fos);
+  });
+  Rng::restore(caller_rng);
+  reset_sample_indices();
+  return offspring_population;
 }
 
-Node * append_linear_scaling(Node * tree) {
+inline Node * append_linear_scaling(Node * tree) {
   // compute intercept and scaling coefficients, append them to the root
   Node * add_n, * mul_n, * slope_n, * interc_n;
 
-  Vec p = tree->get_output(g::fit_func->X_train);
+  Vec p;
+  if (!jit::compiled_output(tree, g::fit_func->X_train, p))
+    p = tree->get_output(g::fit_func->X_train);
 
   pair<float,float> intc_slope = linear_scaling_coeffs(g::fit_func->y_train, p);
   
@@ -312,6 +455,7 @@ Node * append_linear_scaling(Node * tree) {
     interc_n = new Node(new Const(intc_slope.first));
     add_n->append(interc_n);
     add_n->append(tree);
+    add_n->refresh_activity();
     return add_n;
   }
 
@@ -326,6 +470,7 @@ Node * append_linear_scaling(Node * tree) {
 
   // bring fitness info to new root
   add_n->fitness = tree->fitness;
+  add_n->refresh_activity();
 
   return add_n;
 